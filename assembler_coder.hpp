@@ -1,11 +1,39 @@
 #ifndef HW3_ASSEMBLER_CODER_HPP
 #define HW3_ASSEMBLER_CODER_HPP
 #include "bp.hpp"
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <vector>
 using namespace std;
 #define WORD_SIZE 4
 #define DIV_BY_ZERO_LABEL "div_by_zero_error"
 
 class AssemblerCoder{
+    map<string, string> stringLabels; //the label of every string in the pool, by its text without the quotes
+    vector<string> pooledStrings;
+    string exitRoutine; //the routine the program exits through instead of exiting by itself, if any
+
+    //the characters of a string's text, an escape sequence is one character
+    static vector<string> characters(const string &text) {
+        vector<string> chars;
+        for (int i = 0; i < text.size(); i++) {
+            int length = text[i] == '\\' && i + 1 < text.size() ? 2 : 1;
+            chars.push_back(text.substr(i, length));
+            i += length - 1;
+        }
+        return chars;
+    }
+
+    static bool isSuffix(const vector<string> &suffix, const vector<string> &chars) {
+        return suffix.size() <= chars.size() && equal(suffix.begin(), suffix.end(), chars.end() - suffix.size());
+    }
+
+    static string join(const vector<string> &chars, int start, int end) {
+        string text;
+        for (int i = start; i < end; i++) text += chars[i];
+        return text;
+    }
 
 public:
     static AssemblerCoder& getInstance(){
@@ -18,13 +46,55 @@ public:
         return ss.str();
     }
 
-    void emitStringToData(string label,string str){
-         CodeBuffer::instance().emitData(label+" .asciiz \""+str+"\"");
-    }
-
-    void emitStringToDataForString(string label,string str){
-        CodeBuffer::instance().emitData(label+": .asciiz "+str);
-
+    /**
+     * returns the label of the string, given by its text without the quotes. equal strings share one label.
+     */
+    string internString(const string &text) {
+        map<string, string>::iterator found = stringLabels.find(text);
+        if (found != stringLabels.end()) return found->second;
+        pooledStrings.push_back(text);
+        return stringLabels[text] = genDataLabel();
+    }
+
+    /**
+     * emits the pooled strings to the data section. a string that ends a longer one is not emitted again,
+     * its label points into the longer one, which is split by .ascii parts up to its terminating .asciiz.
+     */
+    void emitStringPool() {
+        vector<vector<string> > chars;
+        vector<int> order;
+        for (int i = 0; i < pooledStrings.size(); i++) {
+            chars.push_back(characters(pooledStrings[i]));
+            order.push_back(i);
+        }
+        //the longest strings take the ones they end first
+        vector<int> owners(pooledStrings.size(), -1);
+        for (int i = 0; i < order.size(); i++) {
+            for (int j = i + 1; j < order.size(); j++) {
+                if (chars[order[j]].size() > chars[order[i]].size()) swap(order[i], order[j]);
+            }
+            if (owners[order[i]] != -1) continue;
+            owners[order[i]] = order[i];
+            for (int j = 0; j < pooledStrings.size(); j++) {
+                if (owners[j] == -1 && isSuffix(chars[j], chars[order[i]])) owners[j] = order[i];
+            }
+        }
+        for (int owner = 0; owner < pooledStrings.size(); owner++) {
+            if (owners[owner] != owner) continue;
+            //the labels of the strings that end the owner, by where they start in it
+            map<int, string> starts;
+            for (int i = 0; i < pooledStrings.size(); i++) {
+                if (owners[i] == owner) starts[chars[owner].size() - chars[i].size()] = stringLabels[pooledStrings[i]];
+            }
+            for (map<int, string>::iterator it = starts.begin(); it != starts.end(); ++it) {
+                map<int, string>::iterator next = it;
+                ++next;
+                int end = next == starts.end() ? chars[owner].size() : next->first;
+                string directive = next == starts.end() ? ".asciiz" : ".ascii";
+                CodeBuffer::instance().emitData(it->second + ": " + directive + " \"" + join(chars[owner], it->first, end)
+                                                + "\"");
+            }
+        }
     }
 
     int lw(string destReg,int offset,string address="$fp"){
@@ -52,6 +122,84 @@ public:
         return CodeBuffer::instance().emit("div "+destReg+", "+reg1+", "+reg2);
     }
 
+    int sll(string destReg,string reg,int shift){
+        return CodeBuffer::instance().emit("sll "+destReg+", "+reg+", "+to_string(shift));
+    }
+
+    int srl(string destReg,string reg,int shift){
+        return CodeBuffer::instance().emit("srl "+destReg+", "+reg+", "+to_string(shift));
+    }
+
+    int sra(string destReg,string reg,int shift){
+        return CodeBuffer::instance().emit("sra "+destReg+", "+reg+", "+to_string(shift));
+    }
+
+    int mult(string reg1,string reg2){
+        return CodeBuffer::instance().emit("mult "+reg1+", "+reg2);
+    }
+
+    int mfhi(string destReg){
+        return CodeBuffer::instance().emit("mfhi "+destReg);
+    }
+
+    /**
+     * multiplication by a non negative constant with shifts where possible.
+     * scratchReg may be used when the constant is 2^k+1 or 2^k-1.
+     */
+    void mulByConstant(string destReg,string reg,int value,string scratchReg){
+        int shift = log2(value);
+        if (value == 0) {
+            li(destReg,0);
+        } else if (value == 1) {
+            if (destReg != reg) move(destReg,reg);
+        } else if (shift >= 0) {
+            sll(destReg,reg,shift);
+        } else if (log2(value - 1) > 0) {
+            sll(scratchReg,reg,log2(value - 1));
+            addu(destReg,scratchReg,reg);
+        } else if (value != 0x7fffffff && log2(value + 1) > 0) {
+            sll(scratchReg,reg,log2(value + 1));
+            subu(destReg,scratchReg,reg);
+        } else {
+            li(scratchReg,value);
+            mul(destReg,reg,scratchReg);
+        }
+    }
+
+    /**
+     * division by a positive constant without div - shifts for powers of 2 and a multiplication by
+     * a magic number for the rest. the quotient is truncated toward zero like div does, unless
+     * isNonNegative tells that the dividend is never negative and the cheaper unsigned forms are used.
+     */
+    void divByConstant(string destReg,string reg,int value,bool isNonNegative,string scratchReg){
+        int shift = log2(value);
+        if (value == 1) {
+            if (destReg != reg) move(destReg,reg);
+        } else if (shift > 0 && isNonNegative) {
+            srl(destReg,reg,shift);
+        } else if (shift > 0) {
+            //negative dividends are rounded toward zero by adding 2^shift-1 before the shift
+            sra(scratchReg,reg,31);
+            srl(scratchReg,scratchReg,32 - shift);
+            addu(scratchReg,reg,scratchReg);
+            sra(destReg,scratchReg,shift);
+        } else {
+            int magic, magicShift;
+            signedMagic(value,magic,magicShift);
+            li(scratchReg,magic);
+            mult(reg,scratchReg);
+            mfhi(scratchReg);
+            if (magic < 0) addu(scratchReg,scratchReg,reg);
+            sra(scratchReg,scratchReg,magicShift);
+            if (isNonNegative) {
+                if (destReg != scratchReg) move(destReg,scratchReg);
+            } else {
+                srl(destReg,reg,31); //rounding the negative quotients toward zero
+                addu(destReg,scratchReg,destReg);
+            }
+        }
+    }
+
     int move(string destReg,string srcReg){
         return CodeBuffer::instance().emit("move "+destReg+", "+srcReg);
     }
@@ -114,21 +262,110 @@ public:
 
     void exitSyscall(){
         li("$v0",10);
-        CodeBuffer::instance().emit("syscall");
+        CodeBuffer::instance().emit(exitRoutine == "" ? "syscall" : "j " + exitRoutine);
+    }
+
+    void setExitRoutine(const string &label){
+        exitRoutine = label;
     }
 
-    void printSyscall(int framePinterOffset){
-        lw("$a0",framePinterOffset,"$fp");
+    //the printed value is passed in $a0
+    void printSyscall(){
         li("$v0",4);
         CodeBuffer::instance().emit("syscall");
     }
 
-    void printiSyscall(int framePinterOffset){
-        lw("$a0",framePinterOffset,"$fp");
+    void printiSyscall(){
         li("$v0",1);
         CodeBuffer::instance().emit("syscall");
     }
 
+    /**
+     * computes the multiplier and the shift of a signed division by the constant divisor (2 <= divisor),
+     * as in Hacker's Delight: q = (mulhi(n, magic) [+ n if magic < 0]) >> shift, plus 1 when n is negative.
+     */
+    static void signedMagic(int divisor,int &magic,int &shift){
+        const unsigned int two31 = 0x80000000u;
+        unsigned int ad = divisor;
+        unsigned int anc = two31 - 1 - two31 % ad;
+        int p = 31;
+        unsigned int q1 = two31 / anc, r1 = two31 - q1 * anc;
+        unsigned int q2 = two31 / ad, r2 = two31 - q2 * ad;
+        unsigned int delta;
+        do {
+            p++;
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+            if (r1 >= anc) {
+                q1++;
+                r1 -= anc;
+            }
+            q2 = 2 * q2;
+            r2 = 2 * r2;
+            if (r2 >= ad) {
+                q2++;
+                r2 -= ad;
+            }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        magic = (int)(q2 + 1);
+        shift = p - 32;
+    }
+
+    /**
+     * the commands that set [destReg] to 1 if "reg1 relop reg2" holds and to 0 otherwise, without branching.
+     */
+    static string setOnCondition(string relop,string destReg,string reg1,string reg2){
+        if (relop == "==") return "xor "+destReg+", "+reg1+", "+reg2+"\nsltiu "+destReg+", "+destReg+", 1";
+        if (relop == "!=") return "xor "+destReg+", "+reg1+", "+reg2+"\nsltu "+destReg+", $0, "+destReg;
+        if (relop == "<") return "slt "+destReg+", "+reg1+", "+reg2;
+        if (relop == ">") return "slt "+destReg+", "+reg2+", "+reg1;
+        if (relop == "<=") return "slt "+destReg+", "+reg2+", "+reg1+"\nxori "+destReg+", "+destReg+", 1";
+        return "slt "+destReg+", "+reg1+", "+reg2+"\nxori "+destReg+", "+destReg+", 1"; // >=
+    }
+
+    /**
+     * returns the conditional branch [command] with the opposite condition and the target [label],
+     * or "" if the command is not a conditional branch.
+     */
+    static string invertBranch(const string &command,const string &label){
+        static const string opcodes[] = {"beq", "bne", "blt", "bge", "bgt", "ble"};
+        string opcode = command.substr(0, command.find(' '));
+        for (int i = 0; i < 6; i++) {
+            if (opcodes[i] != opcode) continue;
+            string operands = command.substr(opcode.size(), command.rfind(' ') + 1 - opcode.size());
+            return opcodes[i ^ 1] + operands + label;
+        }
+        return "";
+    }
+
+    /**
+     * checks that the commands only compute values - no calls, syscalls, jumps or stores.
+     */
+    static bool isSideEffectFree(const string &commands){
+        static const string computing[] = {"lw", "li", "la", "move", "addu", "subu", "mul", "div", "mult", "mfhi",
+                                           "sll", "srl", "sra", "andi"};
+        stringstream lines(commands);
+        string command;
+        while (getline(lines, command)) {
+            if (command == "" || command[0] == '#' || command[command.size() - 1] == ':') continue;
+            string opcode = command.substr(0, command.find(' '));
+            if (find(computing, computing + sizeof(computing) / sizeof(computing[0]), opcode)
+                == computing + sizeof(computing) / sizeof(computing[0])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //returns k if value is 2^k, or -1
+    static int log2(int value){
+        if (value <= 0 || (value & (value - 1)) != 0) return -1;
+        int k = 0;
+        while ((1 << k) != value) k++;
+        return k;
+    }
+
     void comment(string str){
         CodeBuffer::instance().emit("#"+str);
     }
@@ -138,8 +375,7 @@ public:
     }
 
     void exit(){
-        li("$v0",10);
-        CodeBuffer::instance().emit("syscall");
+        exitSyscall();
     }
 
     string genDataLabel(){
@@ -2,6 +2,7 @@
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <stdlib.h>
 using namespace std;
 
 CodeBuffer::CodeBuffer() : buffer(), dataDefs() {
@@ -33,10 +34,45 @@ void CodeBuffer::bpatch(const vector<int>& l, const std::string &label){
     }
 }
 
+void CodeBuffer::replace(int address, const std::string &command){
+	buffer[address] = command;
+}
+
+string CodeBuffer::getCommand(int address){
+	return buffer[address];
+}
+
+int CodeBuffer::nextAddress(){
+	return buffer.size();
+}
+
+string CodeBuffer::relocateLabels(const string &command, int offset, int first, int last){
+	string relocated;
+	size_t start = 0;
+	for (size_t found = command.find("label_"); found != string::npos; found = command.find("label_", start)) {
+		size_t numberStart = found + 6;
+		size_t numberEnd = command.find_first_not_of("0123456789", numberStart);
+		if (numberEnd == string::npos) numberEnd = command.size();
+		relocated += command.substr(start, numberStart - start);
+		bool isGenerated = found == 0 || command[found - 1] == ' ';
+		int location = atoi(command.substr(numberStart, numberEnd - numberStart).c_str());
+		if (isGenerated && numberEnd > numberStart && first <= location && location < last) {
+			std::stringstream relocatedLocation;
+			relocatedLocation << location + offset;
+			relocated += relocatedLocation.str();
+		} else {
+			relocated += command.substr(numberStart, numberEnd - numberStart);
+		}
+		start = numberEnd;
+	}
+	return relocated + command.substr(start);
+}
+
 void CodeBuffer::printCodeBuffer(){
 	std::cout << ".text" << std::endl;
 	for (std::vector<string>::const_iterator it = buffer.begin(); it != buffer.end(); ++it) 
 	{
+		if (it->empty()) continue;
 		cout << *it << endl;
     }
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <climits>
 
 class CodeBuffer{
 	CodeBuffer();
@@ -29,6 +30,23 @@ public:
 	void bpatch(const std::vector<int>& address_list, const std::string &loc);
 
 
+	//replaces the command at the given location, used for code that is known only later
+	//(e.g. the registers a function saves are known at its end). empty commands are not printed.
+	//example:
+	//int loc = emit(""); //to be filled
+	//replace(loc,"sw $s0, 0($fp)\nsw $s1, -4($fp)");
+	void replace(int address, const std::string &command);
+
+	//returns the command at the given location
+	std::string getCommand(int address);
+
+	//returns the location of the next command to be emitted
+	int nextAddress();
+
+	//moves the generated labels (label_<location>) the command jumps to by the given offset,
+	//used when code is copied to another location. only the labels located in [first, last) are moved.
+	static std::string relocateLabels(const std::string &command, int offset, int first = 0, int last = INT_MAX);
+
 	//print the content of the code buffer to stdout including a .text header
 	void printCodeBuffer();
 
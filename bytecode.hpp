@@ -0,0 +1,572 @@
+#ifndef HW3_BYTECODE_HPP
+#define HW3_BYTECODE_HPP
+#define BYTECODE_MAGIC "FANC"
+#define BYTECODE_VERSION (1)
+#define IMMEDIATE_OPERAND (0xff) //the register byte of a second source that is an immediate, its word follows
+#define HI_REGISTER (32)
+#define LO_REGISTER (33)
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <iterator>
+#include <string.h>
+#include <stdlib.h>
+#include "simulator.hpp"
+
+using namespace std;
+
+/**
+ * serializes the compiled program into a compact register-based bytecode. the MIPS code is decoded by the
+ * simulator's assembler, and every instruction is written as its operation byte, a byte for every register it
+ * has, and a word only for its immediate and its jump's target. the words are little endian.
+ * the file is "FANC", the version byte, the data's size and bytes, the number of the functions and the name and
+ * first instruction of each, main's first instruction, and the number of the instructions and the instructions.
+ */
+class BytecodeWriter {
+private:
+    typedef Simulator::Instruction Instruction;
+
+    string error;
+
+    static void putByte(ostream &out, unsigned int byte) {
+        out.put((char) (byte & 0xff));
+    }
+
+    static void putWord(ostream &out, unsigned int word) {
+        for (int i = 0; i < 4; i++) putByte(out, word >> (8 * i));
+    }
+
+    static void putSecond(ostream &out, const Instruction &instruction) {
+        if (instruction.second != -1) {
+            putByte(out, instruction.second);
+            return;
+        }
+        putByte(out, IMMEDIATE_OPERAND);
+        putWord(out, instruction.immediate);
+    }
+
+    static void putInstruction(ostream &out, const Instruction &instruction) {
+        putByte(out, instruction.operation);
+        switch (instruction.operation) {
+            case Simulator::SYSCALL:
+            case Simulator::NOP:
+                break;
+            case Simulator::J:
+            case Simulator::JAL:
+                putWord(out, instruction.target);
+                break;
+            case Simulator::JR:
+                putByte(out, instruction.source);
+                break;
+            case Simulator::MFHI:
+            case Simulator::MFLO:
+                putByte(out, instruction.destination);
+                break;
+            case Simulator::LI:
+            case Simulator::LA:
+                putByte(out, instruction.destination);
+                putWord(out, instruction.immediate);
+                break;
+            case Simulator::MOVE:
+                putByte(out, instruction.destination);
+                putByte(out, instruction.source);
+                break;
+            case Simulator::MULT:
+                putByte(out, instruction.source);
+                putSecond(out, instruction);
+                break;
+            case Simulator::LW:
+            case Simulator::SW:
+                putByte(out, instruction.destination);
+                putByte(out, instruction.source);
+                putWord(out, instruction.immediate);
+                break;
+            case Simulator::BEQ:
+            case Simulator::BNE:
+            case Simulator::BLT:
+            case Simulator::BLE:
+            case Simulator::BGT:
+            case Simulator::BGE:
+                putByte(out, instruction.source);
+                putSecond(out, instruction);
+                putWord(out, instruction.target);
+                break;
+            default:
+                putByte(out, instruction.destination);
+                putByte(out, instruction.source);
+                putSecond(out, instruction);
+        }
+    }
+
+public:
+    BytecodeWriter() : error() {}
+
+    /**
+     * writes the bytecode of the MIPS program to [out]. [functions] are the labels the functions start at.
+     * returns false, with the error in getError(), if the program could not be assembled.
+     */
+    bool write(const string &program, const vector<string> &functions, ostream &out) {
+        Simulator assembler(functions);
+        if (!assembler.assemble(program)) {
+            error = assembler.getError();
+            return false;
+        }
+        const vector<Instruction> &code = assembler.getCode();
+        const vector<unsigned char> &data = assembler.getData();
+        out.write(BYTECODE_MAGIC, 4);
+        putByte(out, BYTECODE_VERSION);
+        putWord(out, data.size());
+        if (!data.empty()) out.write((const char *) &data[0], data.size());
+        vector<string> found;
+        for (int i = 0; i < functions.size(); i++) {
+            if (assembler.labelIndex(functions[i]) != -1) found.push_back(functions[i]);
+        }
+        putWord(out, found.size());
+        for (int i = 0; i < found.size(); i++) {
+            putByte(out, found[i].size());
+            out.write(found[i].c_str(), found[i].size() & 0xff);
+            putWord(out, assembler.labelIndex(found[i]));
+        }
+        putWord(out, assembler.labelIndex("main"));
+        putWord(out, code.size());
+        for (int i = 0; i < code.size(); i++) putInstruction(out, code[i]);
+        out.flush();
+        return true;
+    }
+
+    string getError() const {
+        return error;
+    }
+};
+
+/**
+ * runs the bytecode of BytecodeWriter, with the semantics of the simulator, but as fast as it can. the bytecode
+ * is decoded once into an array of operations, each with the address of the code that runs it, and every one
+ * jumps straight to the code of the next one (threaded dispatch by gcc's computed goto).
+ * the immediates are kept in registers after the 32 of MIPS, hi and lo, so that li and la are moves, and every
+ * operation reads its sources from the registers alone. the pairs the compiler emits most are fused into one
+ * operation - a load and a branch on it, an add or a subtract and a branch, the mult and the mfhi of a division
+ * by a constant, and a load, an add and a store to the same word - unless a jump goes between them.
+ * the stack is allocated once, at its full size, so no access grows it.
+ * the words of the memory are read and written in the host's order, which is little endian, like the data's.
+ */
+class BytecodeInterpreter {
+private:
+    enum Kind {
+        MOVE, ADDU, SUBU, MUL, DIV, MULT, AND, OR, XOR, NOR, SLT, SLTU, SLL, SRL, SRA, LW, SW,
+        BEQ, BNE, BLT, BLE, BGT, BGE, J, JAL, JR, SYSCALL, NOP,
+        LW_BEQ, LW_BNE, LW_BLT, LW_BLE, LW_BGT, LW_BGE, ADDU_BEQ, ADDU_BNE, ADDU_BLT, ADDU_BLE, ADDU_BGT, ADDU_BGE,
+        SUBU_BEQ, SUBU_BNE, SUBU_BLT, SUBU_BLE, SUBU_BGT, SUBU_BGE, LW_ADDU_SW, MULT_MOVE, END, KIND_COUNT
+    };
+
+    struct Operation {
+        const void *handler;
+        Kind kind;
+        int destination;
+        int source;
+        int second;
+        int offset; //of a load or a store
+        int target; //the operation a jump goes to
+        int nextSource; //the sources of the second operation of a fused one, a branch or mfhi and mflo
+        int nextSecond;
+
+        Operation() : handler(NULL), kind(NOP), destination(0), source(0), second(0), offset(0), target(0),
+                      nextSource(0), nextSecond(0) {}
+    };
+
+    string bytes;
+    size_t position;
+    vector<unsigned char> data;
+    //stack[i] is the byte at STACK_TOP + 4 - STACK_MAX_BYTES + i. it is allocated by calloc, that maps zero
+    //pages the system fills only when they are touched
+    unsigned char *stack;
+    vector<Operation> code;
+    vector<int> registers;
+    map<int, int> constants; //the register every immediate is kept in
+    set<int> targets; //the operations a jump, a call's return or a code address may go to
+    int entry;
+    string error;
+
+    BytecodeInterpreter(const BytecodeInterpreter &);
+    BytecodeInterpreter &operator=(const BytecodeInterpreter &);
+
+    bool fail(const string &message) {
+        if (error == "") error = message;
+        return false;
+    }
+
+    static string toString(long long num) {
+        stringstream ss;
+        ss << num;
+        return ss.str();
+    }
+
+    bool readByte(int &byte) {
+        if (position >= bytes.size()) return fail("the bytecode is truncated");
+        byte = (unsigned char) bytes[position++];
+        return true;
+    }
+
+    bool readWord(int &word) {
+        if (position + 4 > bytes.size()) return fail("the bytecode is truncated");
+        unsigned int value = 0;
+        for (int i = 3; i >= 0; i--) value = (value << 8) | (unsigned char) bytes[position + i];
+        position += 4;
+        word = (int) value;
+        return true;
+    }
+
+    bool readRegister(int &reg) {
+        return readByte(reg) && (reg < 32 || fail("bad register " + toString(reg)));
+    }
+
+    int constant(int value) {
+        map<int, int>::iterator found = constants.find(value);
+        if (found != constants.end()) return found->second;
+        int reg = registers.size();
+        registers.push_back(value);
+        constants[value] = reg;
+        return reg;
+    }
+
+    bool readSecond(int &second) {
+        if (!readByte(second)) return false;
+        if (second != IMMEDIATE_OPERAND) return second < 32 || fail("bad register " + toString(second));
+        int immediate;
+        if (!readWord(immediate)) return false;
+        second = constant(immediate);
+        return true;
+    }
+
+    bool readTarget(Operation &operation, int count) {
+        if (!readWord(operation.target)) return false;
+        if (operation.target < 0 || operation.target >= count) return fail("bad target " + toString(operation.target));
+        targets.insert(operation.target);
+        return true;
+    }
+
+    bool readOperation(Operation &operation, int count) {
+        int byte;
+        if (!readByte(byte)) return false;
+        if (byte > Simulator::NOP) return fail("bad operation " + toString(byte));
+        Simulator::Operation read = (Simulator::Operation) byte;
+        static const Kind kinds[] = {MOVE, MOVE, MOVE, ADDU, SUBU, MUL, DIV, MULT, MOVE, MOVE, AND, OR, XOR, NOR,
+                                     SLT, SLTU, SLL, SRL, SRA, LW, SW, BEQ, BNE, BLT, BLE, BGT, BGE, J, JAL, JR,
+                                     SYSCALL, NOP};
+        operation.kind = kinds[read];
+        int immediate;
+        switch (read) {
+            case Simulator::SYSCALL:
+            case Simulator::NOP:
+                return true;
+            case Simulator::J:
+            case Simulator::JAL:
+                return readTarget(operation, count);
+            case Simulator::JR:
+                return readRegister(operation.source);
+            case Simulator::MFHI:
+            case Simulator::MFLO:
+                operation.source = read == Simulator::MFHI ? HI_REGISTER : LO_REGISTER;
+                return readRegister(operation.destination);
+            case Simulator::LI:
+            case Simulator::LA:
+                if (!readRegister(operation.destination) || !readWord(immediate)) return false;
+                operation.source = constant(immediate);
+                //a code address may be jumped to by jr
+                if (read == Simulator::LA && (unsigned int) immediate >= TEXT_BASE
+                    && (unsigned int) immediate < TEXT_BASE + 4u * count) {
+                    targets.insert(((unsigned int) immediate - TEXT_BASE) / 4);
+                }
+                return true;
+            case Simulator::MOVE:
+                return readRegister(operation.destination) && readRegister(operation.source);
+            case Simulator::MULT:
+                return readRegister(operation.source) && readSecond(operation.second);
+            case Simulator::LW:
+            case Simulator::SW:
+                return readRegister(operation.destination) && readRegister(operation.source)
+                       && readWord(operation.offset);
+            case Simulator::BEQ:
+            case Simulator::BNE:
+            case Simulator::BLT:
+            case Simulator::BLE:
+            case Simulator::BGT:
+            case Simulator::BGE:
+                return readRegister(operation.source) && readSecond(operation.second) && readTarget(operation, count);
+            default:
+                return readRegister(operation.destination) && readRegister(operation.source)
+                       && readSecond(operation.second);
+        }
+    }
+
+    static bool isBranch(Kind kind) {
+        return kind >= BEQ && kind <= BGE;
+    }
+
+    /**
+     * fuses the pairs and the triples of operations that are not jumped into. the operations after the first
+     * stay in the code, the fused one skips them.
+     */
+    void fuse() {
+        for (int i = 0; i + 1 < code.size(); i++) {
+            Operation &first = code[i];
+            const Operation &second = code[i + 1];
+            if (targets.count(i + 1) != 0) continue;
+            if (first.kind == LW && i + 2 < code.size() && targets.count(i + 2) == 0 && second.kind == ADDU
+                && second.destination == first.destination && code[i + 2].kind == SW
+                && code[i + 2].destination == first.destination && code[i + 2].source == first.source
+                && code[i + 2].offset == first.offset && first.source != first.destination
+                && (second.source == first.destination) != (second.second == first.destination)) {
+                first.kind = LW_ADDU_SW;
+                first.second = second.source == first.destination ? second.second : second.source;
+                continue;
+            }
+            if ((first.kind == LW || first.kind == ADDU || first.kind == SUBU) && isBranch(second.kind)) {
+                Kind fused = first.kind == LW ? LW_BEQ : first.kind == ADDU ? ADDU_BEQ : SUBU_BEQ;
+                first.kind = (Kind) (fused + second.kind - BEQ);
+                first.nextSource = second.source;
+                first.nextSecond = second.second;
+                first.target = second.target;
+            }
+            //the division by a constant is a mult and an mfhi
+            if (first.kind == MULT && second.kind == MOVE
+                && (second.source == HI_REGISTER || second.source == LO_REGISTER)) {
+                first.kind = MULT_MOVE;
+                first.destination = second.destination;
+                first.nextSource = second.source;
+            }
+        }
+    }
+
+    //the memory of a word, or NULL if the address is not in the data or the stack, or is not aligned
+    unsigned char *wordAt(unsigned int address) {
+        if (address % 4 != 0) return NULL;
+        unsigned int index = address - (STACK_TOP + 4 - STACK_MAX_BYTES);
+        if (index < STACK_MAX_BYTES) return &stack[index];
+        index = address - DATA_BASE;
+        if (index < data.size() && data.size() - index >= 4) return &data[index];
+        return NULL;
+    }
+
+    bool printString(unsigned int address, ostream &out) {
+        for (;; address++) {
+            unsigned int index = address - DATA_BASE;
+            if (index >= data.size()) return fail("bad address " + toString(address));
+            if (data[index] == 0) return true;
+            out << data[index];
+        }
+    }
+
+    /**
+     * runs the operations from main on. returns false if the program did something the simulator would not.
+     */
+    bool execute(ostream &out) {
+        static const void *handlers[KIND_COUNT] = {
+                &&move, &&addu, &&subu, &&mul, &&div, &&mult, &&and_, &&or_, &&xor_, &&nor, &&slt, &&sltu, &&sll,
+                &&srl, &&sra, &&lw, &&sw, &&beq, &&bne, &&blt, &&ble, &&bgt, &&bge, &&j, &&jal, &&jr, &&syscall,
+                &&nop, &&lw_beq, &&lw_bne, &&lw_blt, &&lw_ble, &&lw_bgt, &&lw_bge, &&addu_beq, &&addu_bne,
+                &&addu_blt, &&addu_ble, &&addu_bgt, &&addu_bge, &&subu_beq, &&subu_bne, &&subu_blt, &&subu_ble,
+                &&subu_bgt, &&subu_bge, &&lw_addu_sw, &&mult_move, &&end};
+        for (int i = 0; i < code.size(); i++) code[i].handler = handlers[code[i].kind];
+        int *r = &registers[0];
+        Operation *first = &code[0];
+        const Operation *ip = first + entry;
+        unsigned char *word;
+        int value;
+        r[29] = (int) STACK_TOP;
+        r[31] = (int) RETURN_TO_EXIT;
+
+#define DISPATCH() goto *ip->handler
+#define NEXT(count) do { ip += (count); DISPATCH(); } while (0)
+#define JUMP() do { ip = first + ip->target; DISPATCH(); } while (0)
+#define ALU(name, expression) name: r[ip->destination] = (expression); NEXT(1)
+#define A (r[ip->source])
+#define B (r[ip->second])
+#define UA ((unsigned int) r[ip->source])
+#define UB ((unsigned int) r[ip->second])
+#define LOAD(address) if ((word = wordAt(address)) == NULL) goto bad_address; memcpy(&value, word, 4)
+#define BRANCH(name, op) name: if (A op B) JUMP(); else NEXT(1)
+#define TAKEN(op) (r[ip->nextSource] op r[ip->nextSecond])
+#define LW_BRANCH(name, op) \
+        name: LOAD(UA + ip->offset); r[ip->destination] = value; \
+        if (TAKEN(op)) JUMP(); else NEXT(2)
+#define ALU_BRANCH(name, expression, op) \
+        name: r[ip->destination] = (expression); if (TAKEN(op)) JUMP(); else NEXT(2)
+
+        DISPATCH();
+        move: r[ip->destination] = A; NEXT(1);
+        ALU(addu, (int) (UA + UB));
+        ALU(subu, (int) (UA - UB));
+        ALU(mul, (int) (UA * UB));
+        div:
+        if (B == 0) return fail("instruction " + toString(ip - first) + ": division by zero");
+        r[ip->destination] = B == -1 ? (int) (0u - UA) : A / B;
+        NEXT(1);
+        mult: {
+            long long product = (long long) A * B;
+            r[HI_REGISTER] = (int) (product >> 32);
+            r[LO_REGISTER] = (int) product;
+            NEXT(1);
+        }
+        mult_move: {
+            long long product = (long long) A * B;
+            r[HI_REGISTER] = (int) (product >> 32);
+            r[LO_REGISTER] = (int) product;
+            r[ip->destination] = r[ip->nextSource];
+            NEXT(2);
+        }
+        ALU(and_, (int) (UA & UB));
+        ALU(or_, (int) (UA | UB));
+        ALU(xor_, (int) (UA ^ UB));
+        ALU(nor, (int) ~(UA | UB));
+        ALU(slt, A < B);
+        ALU(sltu, UA < UB);
+        ALU(sll, (int) (UA << (UB & 31)));
+        ALU(srl, (int) (UA >> (UB & 31)));
+        ALU(sra, A >> (UB & 31));
+        lw: LOAD(UA + ip->offset); r[ip->destination] = value; NEXT(1);
+        sw:
+        if ((word = wordAt(UA + ip->offset)) == NULL) goto bad_address;
+        memcpy(word, &r[ip->destination], 4);
+        NEXT(1);
+        BRANCH(beq, ==);
+        BRANCH(bne, !=);
+        BRANCH(blt, <);
+        BRANCH(ble, <=);
+        BRANCH(bgt, >);
+        BRANCH(bge, >=);
+        j: JUMP();
+        jal:
+        r[31] = (int) (TEXT_BASE + 4 * (ip - first + 1));
+        JUMP();
+        jr:
+        if (UA == RETURN_TO_EXIT) return true;
+        if (UA < TEXT_BASE || (UA - TEXT_BASE) % 4 != 0 || (UA - TEXT_BASE) / 4 >= code.size()) {
+            return fail("instruction " + toString(ip - first) + ": bad jump");
+        }
+        ip = first + (UA - TEXT_BASE) / 4;
+        DISPATCH();
+        syscall:
+        if (r[2] == 1) {
+            out << r[4];
+        } else if (r[2] == 4) {
+            if (!printString(r[4], out)) return false;
+        } else if (r[2] == 10) {
+            return true;
+        } else {
+            return fail("instruction " + toString(ip - first) + ": unsupported syscall " + toString(r[2]));
+        }
+        NEXT(1);
+        nop: NEXT(1);
+        LW_BRANCH(lw_beq, ==);
+        LW_BRANCH(lw_bne, !=);
+        LW_BRANCH(lw_blt, <);
+        LW_BRANCH(lw_ble, <=);
+        LW_BRANCH(lw_bgt, >);
+        LW_BRANCH(lw_bge, >=);
+        ALU_BRANCH(addu_beq, (int) (UA + UB), ==);
+        ALU_BRANCH(addu_bne, (int) (UA + UB), !=);
+        ALU_BRANCH(addu_blt, (int) (UA + UB), <);
+        ALU_BRANCH(addu_ble, (int) (UA + UB), <=);
+        ALU_BRANCH(addu_bgt, (int) (UA + UB), >);
+        ALU_BRANCH(addu_bge, (int) (UA + UB), >=);
+        ALU_BRANCH(subu_beq, (int) (UA - UB), ==);
+        ALU_BRANCH(subu_bne, (int) (UA - UB), !=);
+        ALU_BRANCH(subu_blt, (int) (UA - UB), <);
+        ALU_BRANCH(subu_ble, (int) (UA - UB), <=);
+        ALU_BRANCH(subu_bgt, (int) (UA - UB), >);
+        ALU_BRANCH(subu_bge, (int) (UA - UB), >=);
+        lw_addu_sw:
+        LOAD(UA + ip->offset);
+        value = (int) ((unsigned int) value + (unsigned int) B);
+        memcpy(word, &value, 4);
+        r[ip->destination] = value;
+        NEXT(3);
+        end:
+        return fail("the program ran out of its code");
+        bad_address:
+        return fail("instruction " + toString(ip - first) + ": bad address");
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef ALU
+#undef A
+#undef B
+#undef UA
+#undef UB
+#undef LOAD
+#undef BRANCH
+#undef TAKEN
+#undef LW_BRANCH
+#undef ALU_BRANCH
+    }
+
+public:
+    BytecodeInterpreter() : bytes(), position(0), data(), stack(NULL), code(), registers(LO_REGISTER + 1, 0),
+                            constants(), targets(), entry(0), error() {}
+
+    ~BytecodeInterpreter() {
+        free(stack);
+    }
+
+    /**
+     * reads and decodes the bytecode. returns false, with the error in getError(), if it is not valid.
+     */
+    bool load(istream &in) {
+        bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        if (bytes.compare(0, 4, BYTECODE_MAGIC) != 0) return fail("not FanC bytecode");
+        position = 4;
+        int version, size, count;
+        if (!readByte(version)) return false;
+        if (version != BYTECODE_VERSION) return fail("unsupported bytecode version " + toString(version));
+        if (!readWord(size)) return false;
+        if (size < 0 || bytes.size() - position < size) return fail("the bytecode is truncated");
+        data.assign(bytes.begin() + position, bytes.begin() + position + size);
+        position += size;
+        //the functions' names are for the tools that read the bytecode, running it needs only main's start
+        if (!readWord(count)) return false;
+        for (int i = 0; i < count; i++) {
+            int length, start;
+            if (!readByte(length)) return false;
+            position += length;
+            if (!readWord(start)) return false;
+        }
+        if (!readWord(entry) || !readWord(count)) return false;
+        if (count < 0 || bytes.size() - position < count) return fail("the bytecode is truncated");
+        if (entry < 0 || entry >= count) return fail("bad entry " + toString(entry));
+        code = vector<Operation>(count);
+        for (int i = 0; i < count; i++) {
+            if (!readOperation(code[i], count)) return false;
+            //the instruction after a call is where it returns to
+            if (code[i].kind == JAL) targets.insert(i + 1);
+            bool isWriting = code[i].kind != MULT && code[i].kind != SW && code[i].kind < BEQ;
+            if (isWriting && code[i].destination == 0) code[i].kind = NOP;
+        }
+        fuse();
+        code.push_back(Operation());
+        code.back().kind = END;
+        bytes.clear();
+        return true;
+    }
+
+    /**
+     * runs the program that was loaded, printing its output to [out]. returns false, with the error in
+     * getError(), if it did something the simulator does not support.
+     */
+    bool run(ostream &out) {
+        if (stack == NULL) stack = (unsigned char *) calloc(STACK_MAX_BYTES, 1);
+        if (stack == NULL) return fail("no memory for the stack");
+        bool isRun = execute(out);
+        out.flush();
+        return isRun;
+    }
+
+    string getError() const {
+        return error;
+    }
+};
+
+#endif //HW3_BYTECODE_HPP
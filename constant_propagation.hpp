@@ -0,0 +1,381 @@
+#ifndef HW3_CONSTANT_PROPAGATION_HPP
+#define HW3_CONSTANT_PROPAGATION_HPP
+#define IMMEDIATE_MIN (-32768LL) //a larger immediate is loaded by the assembler with another instruction
+#define IMMEDIATE_MAX (32767LL)
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <stdlib.h>
+#include "control_flow.hpp"
+#include "range_analysis.hpp"
+
+using namespace std;
+
+/**
+ * sparse conditional constant propagation over the code of a whole function.
+ * the registers and the stack slots that hold a known constant are followed along the edges of the control
+ * flow graph, but a branch whose condition is known sends them only to the block it jumps to - the other one
+ * is not reached from there. the constants of a block are the ones all its reached predecessors agree on.
+ * a branch that is decided becomes a jump or is removed, the code that is not reached is removed, and a
+ * computation of a constant loads it instead.
+ */
+class ConstantPropagation {
+private:
+    typedef ControlFlowGraph::Instruction Instruction;
+    typedef ControlFlowGraph::Block Block;
+
+    //the registers and the stack slots that hold a known constant at a point of the code
+    struct Constants {
+        bool isReached;
+        map<string, int> registers;
+        map<string, int> slots;
+
+        Constants() : isReached(false), registers(), slots() {}
+    };
+
+    int foldedCount;
+    int unreachableCount;
+    int loadedCount;
+
+    ConstantPropagation() : foldedCount(0), unreachableCount(0), loadedCount(0) {}
+
+    static bool constantOf(const Constants &constants, const string &operand, int &value) {
+        if (operand == "$0") {
+            value = 0;
+            return true;
+        }
+        if (ControlFlowGraph::isRegister(operand)) {
+            map<string, int>::const_iterator found = constants.registers.find(operand);
+            if (found == constants.registers.end()) return false;
+            value = found->second;
+            return true;
+        }
+        if (operand == "" || operand.find_first_not_of("-0123456789") != string::npos) return false;
+        value = (int) atoll(operand.c_str());
+        return true;
+    }
+
+    /**
+     * computes the result of the opcode on two 32 bit values, as the machine does. returns false if it traps.
+     */
+    static bool evaluate(const string &opcode, int first, int second, int &result) {
+        unsigned int a = first, b = second;
+        if (opcode == "addu") {
+            result = a + b;
+        } else if (opcode == "subu") {
+            result = a - b;
+        } else if (opcode == "mul") {
+            result = a * b;
+        } else if (opcode == "div") {
+            if (second == 0 || (first == INT_MIN_VALUE && second == -1)) return false;
+            result = first / second;
+        } else if (opcode == "and" || opcode == "andi") {
+            result = a & b;
+        } else if (opcode == "or" || opcode == "ori") {
+            result = a | b;
+        } else if (opcode == "xor" || opcode == "xori") {
+            result = a ^ b;
+        } else if (opcode == "nor") {
+            result = ~(a | b);
+        } else if (opcode == "slt") {
+            result = first < second;
+        } else if (opcode == "sltu" || opcode == "sltiu") {
+            result = a < b;
+        } else if (opcode == "sll") {
+            result = a << (b & 31);
+        } else if (opcode == "srl") {
+            result = a >> (b & 31);
+        } else if (opcode == "sra") {
+            result = first >> (b & 31);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    //returns 1 if the branch is taken, 0 if it is not and -1 if it is not known
+    static int decide(const Constants &constants, const Instruction &branch) {
+        const string &opcode = branch.opcode;
+        const string &first = branch.operands[0], &second = branch.operands[1];
+        int a, b;
+        if (first == second) {
+            a = b = 0;
+        } else if (!constantOf(constants, first, a) || !constantOf(constants, second, b)) {
+            return -1;
+        }
+        if (opcode == "beq") return a == b;
+        if (opcode == "bne") return a != b;
+        if (opcode == "blt") return a < b;
+        if (opcode == "ble") return a <= b;
+        if (opcode == "bgt") return a > b;
+        if (opcode == "bge") return a >= b;
+        return -1;
+    }
+
+    static void forgetSlots(Constants &constants, const string &base) {
+        for (map<string, int>::iterator it = constants.slots.begin(); it != constants.slots.end();) {
+            if (base == "" || ControlFlowGraph::baseRegister(it->first) == base) {
+                constants.slots.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    static void forgetRegister(Constants &constants, const string &reg) {
+        constants.registers.erase(reg);
+        //a slot is addressed by the value of its register
+        if (reg == "$fp" || reg == "$sp") forgetSlots(constants, reg);
+    }
+
+    //a call keeps only the stored registers
+    static void forgetCalled(Constants &constants) {
+        for (map<string, int>::iterator it = constants.registers.begin(); it != constants.registers.end();) {
+            if (it->first.find("$s") == 0 || it->first == "$fp" || it->first == "$sp") {
+                ++it;
+            } else {
+                constants.registers.erase(it++);
+            }
+        }
+        constants.slots.clear();
+    }
+
+    /**
+     * the constant the instruction writes to its register. returns false if it is not known.
+     */
+    static bool computeConstant(const Constants &constants, const Instruction &instruction, int &value) {
+        const string &opcode = instruction.opcode;
+        const vector<string> &operands = instruction.operands;
+        if (opcode == "li" || opcode == "move") return constantOf(constants, operands[1], value);
+        if (opcode == "mfhi") return constantOf(constants, "$hi", value);
+        if (opcode == "lw") {
+            map<string, int>::const_iterator slot = constants.slots.find(operands[1]);
+            if (slot == constants.slots.end()) return false;
+            value = slot->second;
+            return true;
+        }
+        int a, b;
+        if (opcode == "mult") {
+            if (!constantOf(constants, operands[0], a) || !constantOf(constants, operands[1], b)) return false;
+            value = (int) (((long long) a * b) >> 32);
+            return true;
+        }
+        if (operands.size() != 3 || !constantOf(constants, operands[1], a) || !constantOf(constants, operands[2], b)) {
+            return false;
+        }
+        return evaluate(opcode, a, b, value);
+    }
+
+    /**
+     * changes the constants as the instruction runs.
+     */
+    static void step(Constants &constants, const Instruction &instruction) {
+        const string &opcode = instruction.opcode;
+        if (opcode == "") {
+            if (instruction.isCall) forgetCalled(constants);
+            for (set<string>::const_iterator it = instruction.keptWrites.begin();
+                 it != instruction.keptWrites.end(); ++it) {
+                forgetRegister(constants, *it);
+            }
+            constants.slots.clear();
+        } else if (opcode == "jal") {
+            forgetCalled(constants);
+        } else if (opcode == "syscall") {
+            //printing leaves the registers as they are
+            int service;
+            if (!constantOf(constants, "$v0", service) || (service != 1 && service != 4)) {
+                constants.registers.erase("$v0");
+            }
+        } else if (opcode == "sw") {
+            string base = ControlFlowGraph::baseRegister(instruction.operands[1]);
+            //the frame is addressed only by $fp and $sp, a slot of one of them may be a slot of the other
+            forgetSlots(constants, base == "$fp" ? "$sp" : base == "$sp" ? "$fp" : "");
+            int value;
+            if (constantOf(constants, instruction.operands[0], value)) {
+                constants.slots[instruction.operands[1]] = value;
+            } else {
+                constants.slots.erase(instruction.operands[1]);
+            }
+        } else if (opcode == "mult" || opcode == "lw" || ControlFlowGraph::isComputation(opcode)) {
+            string reg = ControlFlowGraph::written(instruction);
+            int value;
+            bool isConstant = computeConstant(constants, instruction, value);
+            forgetRegister(constants, reg);
+            if (isConstant) constants.registers[reg] = value;
+        } else if (ControlFlowGraph::isKeptAsIs(instruction)) {
+            constants.registers.clear();
+            constants.slots.clear();
+        }
+    }
+
+    //keeps the constants both sides agree on, returns true if [constants] changed
+    static bool meet(Constants &constants, const Constants &other) {
+        if (!constants.isReached) {
+            constants = other;
+            constants.isReached = true;
+            return true;
+        }
+        bool isChanged = false;
+        map<string, int> *maps[] = {&constants.registers, &constants.slots};
+        const map<string, int> *others[] = {&other.registers, &other.slots};
+        for (int i = 0; i < 2; i++) {
+            for (map<string, int>::iterator it = maps[i]->begin(); it != maps[i]->end();) {
+                map<string, int>::const_iterator found = others[i]->find(it->first);
+                if (found == others[i]->end() || found->second != it->second) {
+                    maps[i]->erase(it++);
+                    isChanged = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return isChanged;
+    }
+
+    //returns the block that starts at the label, or -1
+    static int targetBlock(const ControlFlowGraph &graph, const string &label) {
+        int address = graph.labelAddress(label);
+        for (int i = 0; i < graph.blocks.size() && address != -1; i++) {
+            if (graph.blocks[i].address == address) return i;
+        }
+        return -1;
+    }
+
+    /**
+     * the blocks the end of the block leads to with the constants it ends with.
+     */
+    static vector<int> reachedSuccessors(const ControlFlowGraph &graph, int block, const Constants &constants) {
+        const Block &from = graph.blocks[block];
+        if (from.end > from.first) {
+            const Instruction &last = graph.instructions[from.end - 1];
+            if (last.opcode[0] == 'b' && decide(constants, last) != -1) {
+                vector<int> reached;
+                int to = decide(constants, last) == 1 ? targetBlock(graph, last.operands.back()) : block + 1;
+                if (to != -1 && to < graph.blocks.size()) reached.push_back(to);
+                return reached;
+            }
+        }
+        return from.successors;
+    }
+
+    /**
+     * the constants at the start of every block, a block that is not reached is left with isReached false.
+     */
+    static vector<Constants> propagate(const ControlFlowGraph &graph) {
+        vector<Constants> starts(graph.blocks.size());
+        set<int> work;
+        for (int i = 0; i < graph.blocks.size(); i++) {
+            if (!graph.isRoot(i)) continue;
+            starts[i].isReached = true;
+            work.insert(i);
+        }
+        while (!work.empty()) {
+            int block = *work.begin();
+            work.erase(work.begin());
+            Constants constants = starts[block];
+            for (int i = graph.blocks[block].first; i < graph.blocks[block].end; i++) {
+                step(constants, graph.instructions[i]);
+            }
+            vector<int> successors = reachedSuccessors(graph, block, constants);
+            for (int i = 0; i < successors.size(); i++) {
+                if (meet(starts[successors[i]], constants)) work.insert(successors[i]);
+            }
+        }
+        return starts;
+    }
+
+    static bool isImmediate(int value) {
+        return IMMEDIATE_MIN <= value && value <= IMMEDIATE_MAX;
+    }
+
+    /**
+     * folds the instructions of a reached block with the constants at its start.
+     */
+    void foldBlock(ControlFlowGraph &graph, int block, Constants constants) {
+        for (int i = graph.blocks[block].first; i < graph.blocks[block].end; i++) {
+            Instruction &instruction = graph.instructions[i];
+            Instruction original = instruction;
+            const string &opcode = original.opcode;
+            int value;
+            if (opcode != "" && opcode[0] == 'b' && decide(constants, original) != -1) {
+                if (decide(constants, original) == 1) {
+                    instruction.opcode = "j";
+                    instruction.operands = vector<string>(1, original.operands.back());
+                } else {
+                    instruction.isRemoved = true;
+                }
+                foldedCount++;
+            } else if ((opcode == "lw" || (ControlFlowGraph::isComputation(opcode) && opcode != "li"))
+                       && original.operands[0] != "$sp" && original.operands[0] != "$fp"
+                       && computeConstant(constants, original, value)) {
+                instruction.opcode = "li";
+                instruction.operands.resize(2);
+                instruction.operands[1] = AssemblerCoder::to_string(value);
+                loadedCount++;
+            } else if ((opcode == "addu" || opcode == "subu") && original.operands[1] != "$sp"
+                       && original.operands[1] != "$fp") {
+                //a constant operand is given as an immediate, it needs no register
+                int first;
+                bool isFirstConstant = constantOf(constants, original.operands[1], first);
+                if (!isFirstConstant && constantOf(constants, original.operands[2], value) && isImmediate(value)) {
+                    instruction.operands[2] = AssemblerCoder::to_string(value);
+                } else if (opcode == "addu" && isFirstConstant && isImmediate(first)
+                           && ControlFlowGraph::isRegister(original.operands[2]) && original.operands[2] != "$sp"
+                           && original.operands[2] != "$fp") {
+                    instruction.operands[1] = original.operands[2];
+                    instruction.operands[2] = AssemblerCoder::to_string(first);
+                }
+            }
+            step(constants, original);
+        }
+    }
+
+    /**
+     * removes the instructions of a block that is not reached. the calls and the returns are kept, other
+     * passes look for them at their addresses.
+     */
+    void removeBlock(ControlFlowGraph &graph, int block) {
+        for (int i = graph.blocks[block].first; i < graph.blocks[block].end; i++) {
+            Instruction &instruction = graph.instructions[i];
+            if (ControlFlowGraph::isKeptAsIs(instruction)) continue;
+            //a jump to another function is a tail call
+            if (instruction.opcode == "j" && graph.labelAddress(instruction.operands[0]) == -1) continue;
+            instruction.isRemoved = true;
+            unreachableCount++;
+        }
+    }
+
+public:
+    static ConstantPropagation &getInstance() {
+        static ConstantPropagation INSTANCE;
+        return INSTANCE;
+    }
+
+    /**
+     * propagates the constants of the function's code in [functionStart, functionEnd), folds the branches they
+     * decide and removes the code that is not reached. the code must not be changed by addresses that were
+     * kept before, other than its jumps.
+     */
+    void optimizeFunction(int functionStart, int functionEnd) {
+        //the constants do not depend on what is read after the function
+        ControlFlowGraph graph(functionStart, functionEnd, set<string>());
+        if (!graph.isLinked) return;
+        vector<Constants> starts = propagate(graph);
+        for (int i = 0; i < graph.blocks.size(); i++) {
+            if (starts[i].isReached) {
+                foldBlock(graph, i, starts[i]);
+            } else {
+                removeBlock(graph, i);
+            }
+        }
+        graph.rewrite();
+    }
+
+    void printReport(ostream &out) {
+        out << "folded " << foldedCount << " branches, removed " << unreachableCount << " unreachable instructions"
+            << " and loaded " << loadedCount << " constants" << endl;
+    }
+};
+
+#endif //HW3_CONSTANT_PROPAGATION_HPP
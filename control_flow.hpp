@@ -0,0 +1,497 @@
+#ifndef HW3_CONTROL_FLOW_HPP
+#define HW3_CONTROL_FLOW_HPP
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+#include "bp.hpp"
+#include "assembler_coder.hpp"
+#include "registers.hpp"
+
+using namespace std;
+
+/**
+ * the code of a function once it is complete, parsed into instructions and split into basic blocks, with the
+ * dominators and the live registers of the blocks. the passes that change the instructions write them back
+ * to the lines they were parsed from with rewrite().
+ */
+class ControlFlowGraph {
+public:
+    struct Instruction {
+        int address;
+        int part; //the line of the command at [address]
+        string opcode; //"" for a command of several lines with labels or jumps inside, it is kept as it is
+        vector<string> operands; //the jump targets of a command that is kept as it is
+        bool isRemoved;
+        set<string> keptWrites; //the registers a command that is kept as it is writes
+        bool isCall;
+
+        Instruction(int _address, int _part, string _opcode, const vector<string> &_operands)
+                : address(_address), part(_part), opcode(_opcode), operands(_operands), isRemoved(false),
+                  keptWrites(), isCall(_opcode == "jal") {}
+
+        string toString() const {
+            string command = opcode;
+            for (int i = 0; i < operands.size(); i++) command += (i == 0 ? " " : ", ") + operands[i];
+            return command;
+        }
+    };
+
+    struct Block {
+        int address;
+        int first; //the instructions of the block are [first, end)
+        int end;
+        vector<int> successors; //the target of the jump that ends the block first
+        vector<int> predecessors;
+        bool isExit; //the function may be left from the block with any register in use
+        int dominator;
+        vector<int> dominated;
+        set<string> writes;
+        bool isClobbering; //a call or a command that is kept as it is, every register may change
+        bool isStoring;
+        set<string> liveOut;
+
+        Block(int _address, int _first)
+                : address(_address), first(_first), end(_first), successors(), predecessors(), isExit(false),
+                  dominator(-1), dominated(), writes(), isClobbering(false), isStoring(false), liveOut() {}
+    };
+
+    vector<Instruction> instructions;
+    vector<Block> blocks;
+    vector<bool> isEntered; //the block can be jumped to from outside of the function's code
+    set<string> allRegisters; //the registers the function's code uses
+    set<string> exitRegisters; //the registers that may be read after the function is left
+    bool isLinked; //false if a jump goes into the middle of a block, the code is then left as it is
+
+    /**
+     * parses the code in [start, end). [returned] are the registers the caller reads after the function returns,
+     * $v0 if it returns a value and none for main, that exits the program. if [isRestoringStored], the stored
+     * registers are restored when the function is left, so their values are not read after it.
+     */
+    ControlFlowGraph(int _start, int _end, const set<string> &returned, bool isRestoringStored = false)
+            : instructions(), blocks(), isEntered(), allRegisters(), exitRegisters(returned), isLinked(false),
+              start(_start), end(_end) {
+        buildBlocks();
+        //the temporaries and the arguments are the caller's to save, only its frame is kept for it
+        exitRegisters.insert("$ra");
+        exitRegisters.insert("$sp");
+        exitRegisters.insert("$fp");
+        for (set<string>::iterator it = allRegisters.begin(); it != allRegisters.end() && !isRestoringStored; ++it) {
+            if (isStoredRegister(*it)) exitRegisters.insert(*it);
+        }
+        isLinked = !blocks.empty() && linkBlocks();
+        if (!isLinked) return;
+        findDominators();
+        findLiveRegisters();
+    }
+
+    static bool isRegister(const string &operand) {
+        return operand.size() > 1 && operand[0] == '$';
+    }
+
+    static bool isStoredRegister(const string &reg) {
+        return reg.size() > 2 && reg.compare(0, 2, "$s") == 0 && isdigit(reg[2]);
+    }
+
+    static bool isLabel(const string &command) {
+        return command != "" && command[0] != '#' && command[command.size() - 1] == ':';
+    }
+
+    static bool isCommand(const string &command) {
+        return command != "" && command[0] != '#' && !isLabel(command);
+    }
+
+    static bool isJump(const string &opcode) {
+        return opcode[0] == 'b' || opcode == "j" || opcode == "jr" || opcode == "jal";
+    }
+
+    static bool isComputation(const string &opcode) {
+        static const string computing[] = {"li", "la", "move", "addu", "subu", "mul", "div", "and", "or", "xor",
+                                           "nor", "slt", "sltu", "sltiu", "xori", "andi", "ori", "sll", "srl",
+                                           "sra", "mfhi"};
+        return find(computing, computing + sizeof(computing) / sizeof(computing[0]), opcode)
+               != computing + sizeof(computing) / sizeof(computing[0]);
+    }
+
+    static bool isCommutative(const string &opcode) {
+        return opcode == "addu" || opcode == "mul" || opcode == "mult" || opcode == "and" || opcode == "or"
+               || opcode == "xor" || opcode == "nor";
+    }
+
+    //the register a stack slot operand of the form "offset(register)" is relative to
+    static string baseRegister(const string &operand) {
+        size_t open = operand.find('(');
+        if (open == string::npos) return "";
+        return operand.substr(open + 1, operand.size() - open - 2);
+    }
+
+    //returns the address of a generated label in the function's code, or -1
+    int labelAddress(const string &label) const {
+        if (label.find("label_") != 0 || label.find_first_not_of("0123456789", 6) != string::npos) return -1;
+        int address = atoi(label.substr(6).c_str());
+        return start <= address && address < end ? address : -1;
+    }
+
+    bool isRoot(int block) const {
+        return block == 0 || isEntered[block];
+    }
+
+    static bool isKeptAsIs(const Instruction &instruction) {
+        return instruction.opcode == "" || instruction.opcode == "jal" || instruction.opcode == "jr"
+               || (!isComputation(instruction.opcode) && !isJump(instruction.opcode) && instruction.opcode != "lw"
+                   && instruction.opcode != "sw" && instruction.opcode != "mult"
+                   && instruction.opcode != "syscall");
+    }
+
+    //a jump to a label outside of the function's code that is not an error, like a tail call or the exit routine
+    bool isLeaving(const Instruction &instruction) const {
+        return (instruction.opcode == "j" || instruction.opcode[0] == 'b')
+               && labelAddress(instruction.operands.back()) == -1 && !isErrorLabel(instruction.operands.back());
+    }
+
+    /**
+     * the registers the instruction reads, the ones that are kept as they are may read any register. a call
+     * reads its arguments, the ones after the fourth from the stack, and a jump out of the function may also be
+     * a tail call or the exit routine, that reads $v0.
+     */
+    vector<string> reads(const Instruction &instruction) const {
+        vector<string> regs;
+        const string &opcode = instruction.opcode;
+        const vector<string> &operands = instruction.operands;
+        if (opcode == "jr") {
+            regs.insert(regs.end(), exitRegisters.begin(), exitRegisters.end());
+        } else if (opcode == "jal") {
+            for (int i = 0; i < ARGUMENT_REG_NUM; i++) regs.push_back(Registers::argumentRegister(i));
+            regs.push_back("$sp");
+        } else if (isLeaving(instruction)) {
+            regs.insert(regs.end(), exitRegisters.begin(), exitRegisters.end());
+            for (int i = 0; i < ARGUMENT_REG_NUM; i++) regs.push_back(Registers::argumentRegister(i));
+            regs.push_back("$v0");
+            for (int i = 0; i < operands.size() - 1; i++) {
+                if (isRegister(operands[i])) regs.push_back(operands[i]);
+            }
+        } else if (isKeptAsIs(instruction)) {
+            regs.insert(regs.end(), allRegisters.begin(), allRegisters.end());
+        } else if (opcode == "syscall") {
+            regs.push_back("$v0");
+            regs.push_back("$a0");
+        } else if (opcode == "mfhi") {
+            regs.push_back("$hi");
+        } else if (opcode == "sw" || opcode == "mult" || opcode[0] == 'b') {
+            int last = opcode[0] == 'b' ? operands.size() - 1 : operands.size();
+            for (int i = 0; i < last; i++) {
+                if (isRegister(operands[i])) regs.push_back(operands[i]);
+            }
+        } else {
+            for (int i = 1; i < operands.size(); i++) {
+                if (isRegister(operands[i])) regs.push_back(operands[i]);
+            }
+        }
+        if (opcode == "lw" || opcode == "sw") regs.push_back(baseRegister(operands.back()));
+        return regs;
+    }
+
+    //the register the instruction writes, or ""
+    static string written(const Instruction &instruction) {
+        if (instruction.opcode == "mult") return "$hi";
+        if (instruction.opcode == "syscall") return "$v0"; //unless it only prints
+        if (isComputation(instruction.opcode) || instruction.opcode == "lw") return instruction.operands[0];
+        return "";
+    }
+
+    /**
+     * the blocks on the paths from the end of [dominator] to the start of [block].
+     */
+    vector<int> pathsBetween(int dominator, int block) const {
+        vector<bool> isReached(blocks.size(), false), isReaching(blocks.size(), false);
+        vector<int> work = blocks[dominator].successors;
+        while (!work.empty()) {
+            int next = work.back();
+            work.pop_back();
+            if (next == dominator || isReached[next]) continue;
+            isReached[next] = true;
+            work.insert(work.end(), blocks[next].successors.begin(), blocks[next].successors.end());
+        }
+        work = blocks[block].predecessors;
+        while (!work.empty()) {
+            int next = work.back();
+            work.pop_back();
+            if (next == dominator || isReaching[next]) continue;
+            isReaching[next] = true;
+            work.insert(work.end(), blocks[next].predecessors.begin(), blocks[next].predecessors.end());
+        }
+        vector<int> between;
+        for (int i = 0; i < blocks.size(); i++) {
+            if (isReached[i] && isReaching[i]) between.push_back(i);
+        }
+        return between;
+    }
+
+    /**
+     * writes the changed instructions back to their lines in the code buffer.
+     */
+    void rewrite() const {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        map<int, vector<string> > lines;
+        for (int i = 0; i < instructions.size(); i++) {
+            const Instruction &instruction = instructions[i];
+            if (instruction.opcode == "") continue;
+            if (lines.count(instruction.address) == 0) {
+                lines[instruction.address] = split(codeBuffer.getCommand(instruction.address), '\n');
+            }
+            lines[instruction.address][instruction.part] = instruction.isRemoved ? "" : instruction.toString();
+        }
+        for (map<int, vector<string> >::iterator it = lines.begin(); it != lines.end(); ++it) {
+            string command;
+            bool isEmpty = true;
+            for (int i = 0; i < it->second.size(); i++) {
+                if (it->second[i] == "") continue;
+                command += (command == "" ? "" : "\n") + it->second[i];
+                isEmpty = isEmpty && !isCommand(it->second[i]);
+            }
+            //the comments of a line go with its last command
+            if (isEmpty) command = "";
+            if (command != codeBuffer.getCommand(it->first)) codeBuffer.replace(it->first, command);
+        }
+    }
+
+private:
+    int start;
+    int end;
+
+    //the errors end the program, no register is in use there
+    static bool isErrorLabel(const string &label) {
+        return label == DIV_BY_ZERO_LABEL || label.find("precond_err_") == 0;
+    }
+
+    static vector<string> split(const string &text, char separator) {
+        vector<string> parts;
+        size_t partStart = 0;
+        for (size_t found = text.find(separator); found != string::npos; found = text.find(separator, partStart)) {
+            parts.push_back(text.substr(partStart, found - partStart));
+            partStart = found + 1;
+        }
+        parts.push_back(text.substr(partStart));
+        return parts;
+    }
+
+    static Instruction parse(int address, int part, const string &command) {
+        size_t space = command.find(' ');
+        vector<string> operands;
+        if (space != string::npos) {
+            operands = split(command.substr(space + 1), ',');
+            for (int i = 1; i < operands.size(); i++) operands[i] = operands[i].substr(1);
+        }
+        return Instruction(address, part, command.substr(0, space), operands);
+    }
+
+    void collectRegisters(const Instruction &instruction) {
+        for (int i = 0; i < instruction.operands.size(); i++) {
+            string reg = instruction.operands[i];
+            if (!isRegister(reg)) reg = baseRegister(reg);
+            if (isRegister(reg)) allRegisters.insert(reg);
+        }
+    }
+
+    /**
+     * splits [start, end) into blocks: a block starts at a label and after a jump.
+     */
+    void buildBlocks() {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        bool isLeader = true;
+        for (int address = start; address < end; address++) {
+            string command = codeBuffer.getCommand(address);
+            vector<string> parts = split(command, '\n');
+            if (isLabel(command) || isLeader) {
+                blocks.push_back(Block(address, instructions.size()));
+                //a function's own labels are jumped to only from its code
+                isEntered.push_back(isLabel(command) && command.find("label_") != 0);
+            }
+            isLeader = false;
+            //a jump that ends the line ends the block with it
+            bool isKept = false;
+            bool isJumped = false;
+            for (int i = 0; i < parts.size() && parts.size() > 1; i++) {
+                if (isLabel(parts[i]) || (isCommand(parts[i]) && isJumped)) isKept = true;
+                if (isCommand(parts[i]) && isJump(parse(address, i, parts[i]).opcode)) isJumped = true;
+            }
+            if (isKept) {
+                Instruction kept(address, 0, "", vector<string>());
+                for (int i = 0; i < parts.size(); i++) {
+                    if (!isCommand(parts[i])) continue;
+                    Instruction part = parse(address, i, parts[i]);
+                    collectRegisters(part);
+                    if (isJump(part.opcode) && part.opcode != "jal") kept.operands.push_back(part.operands.back());
+                    if (written(part) != "") kept.keptWrites.insert(written(part));
+                    kept.isCall = kept.isCall || part.isCall;
+                }
+                instructions.push_back(kept);
+                isLeader = true;
+                continue;
+            }
+            for (int i = 0; i < parts.size(); i++) {
+                if (!isCommand(parts[i])) continue;
+                Instruction instruction = parse(address, i, parts[i]);
+                collectRegisters(instruction);
+                instructions.push_back(instruction);
+                if (isJump(instruction.opcode) && instruction.opcode != "jal") isLeader = true;
+            }
+        }
+        for (int i = 0; i < blocks.size(); i++) {
+            blocks[i].end = i + 1 < blocks.size() ? blocks[i + 1].first : instructions.size();
+        }
+        allRegisters.insert("$v0");
+        allRegisters.insert("$hi");
+        for (int i = 0; i < ARGUMENT_REG_NUM; i++) allRegisters.insert(Registers::argumentRegister(i));
+    }
+
+    //returns the block that starts at the address, or -1
+    int blockAt(int address) const {
+        for (int i = 0; i < blocks.size(); i++) {
+            if (blocks[i].address == address) return i;
+        }
+        return -1;
+    }
+
+    /**
+     * returns false if the label is in the code, but not at the start of a block.
+     */
+    bool addEdge(int from, const string &label) {
+        int address = labelAddress(label);
+        if (address == -1) {
+            if (!isErrorLabel(label)) blocks[from].isExit = true;
+            return true;
+        }
+        int to = blockAt(address);
+        if (to == -1) return false;
+        blocks[from].successors.push_back(to);
+        blocks[to].predecessors.push_back(from);
+        return true;
+    }
+
+    bool linkBlocks() {
+        bool isLinked = true;
+        for (int i = 0; i < blocks.size(); i++) {
+            Block &block = blocks[i];
+            bool isFallingThrough = true;
+            for (int j = block.first; j < block.end; j++) {
+                const Instruction &instruction = instructions[j];
+                string reg = written(instruction);
+                if (reg != "") block.writes.insert(reg);
+                if (isKeptAsIs(instruction)) block.isClobbering = true;
+                if (instruction.opcode == "sw") block.isStoring = true;
+            }
+            if (block.end > block.first) {
+                const Instruction &last = instructions[block.end - 1];
+                if (last.opcode == "") {
+                    for (int j = 0; j < last.operands.size(); j++) isLinked = addEdge(i, last.operands[j]) && isLinked;
+                } else if (last.opcode == "jr") {
+                    block.isExit = true;
+                    isFallingThrough = false;
+                } else if (last.opcode == "j") {
+                    isLinked = addEdge(i, last.operands[0]) && isLinked;
+                    isFallingThrough = false;
+                } else if (last.opcode[0] == 'b') {
+                    isLinked = addEdge(i, last.operands.back()) && isLinked;
+                }
+            }
+            if (isFallingThrough) {
+                if (i + 1 < blocks.size()) {
+                    block.successors.push_back(i + 1);
+                    blocks[i + 1].predecessors.push_back(i);
+                } else {
+                    block.isExit = true;
+                }
+            }
+        }
+        return isLinked;
+    }
+
+    void postOrder(int block, vector<bool> &isVisited, vector<int> &order) const {
+        isVisited[block] = true;
+        for (int i = 0; i < blocks[block].successors.size(); i++) {
+            if (!isVisited[blocks[block].successors[i]]) postOrder(blocks[block].successors[i], isVisited, order);
+        }
+        order.push_back(block);
+    }
+
+    /**
+     * the dominators by the iterative algorithm of Cooper, Harvey and Kennedy. the blocks that are entered
+     * from outside of the code are dominated by a virtual entry, which blocks.size() stands for.
+     */
+    void findDominators() {
+        int root = blocks.size();
+        vector<bool> isVisited(blocks.size(), false);
+        vector<int> order;
+        for (int i = blocks.size() - 1; i >= 0; i--) {
+            if (isRoot(i) && !isVisited[i]) postOrder(i, isVisited, order);
+        }
+        vector<int> orderIndex(blocks.size() + 1, -1);
+        for (int i = 0; i < order.size(); i++) orderIndex[order[i]] = i;
+        orderIndex[root] = order.size();
+        vector<int> dominators(blocks.size() + 1, -1);
+        dominators[root] = root;
+        bool isChanged = true;
+        while (isChanged) {
+            isChanged = false;
+            for (int i = order.size() - 1; i >= 0; i--) {
+                int block = order[i];
+                vector<int> predecessors = blocks[block].predecessors;
+                if (isRoot(block)) predecessors.push_back(root);
+                int dominator = -1;
+                for (int j = 0; j < predecessors.size(); j++) {
+                    int predecessor = predecessors[j];
+                    if (dominators[predecessor] == -1) continue;
+                    if (dominator == -1) {
+                        dominator = predecessor;
+                        continue;
+                    }
+                    int other = predecessor;
+                    while (dominator != other) {
+                        while (orderIndex[dominator] < orderIndex[other]) dominator = dominators[dominator];
+                        while (orderIndex[other] < orderIndex[dominator]) other = dominators[other];
+                    }
+                }
+                if (dominators[block] != dominator) {
+                    dominators[block] = dominator;
+                    isChanged = true;
+                }
+            }
+        }
+        for (int i = 0; i < blocks.size(); i++) {
+            blocks[i].dominator = dominators[i] == root ? -1 : dominators[i];
+            if (dominators[i] != -1 && dominators[i] != root) blocks[dominators[i]].dominated.push_back(i);
+        }
+    }
+
+    void findLiveRegisters() {
+        vector<set<string> > liveIn(blocks.size());
+        bool isChanged = true;
+        while (isChanged) {
+            isChanged = false;
+            for (int i = blocks.size() - 1; i >= 0; i--) {
+                Block &block = blocks[i];
+                set<string> live = block.isExit ? exitRegisters : set<string>();
+                for (int j = 0; j < block.successors.size(); j++) {
+                    live.insert(liveIn[block.successors[j]].begin(), liveIn[block.successors[j]].end());
+                }
+                block.liveOut = live;
+                for (int j = block.end - 1; j >= block.first; j--) {
+                    string reg = written(instructions[j]);
+                    if (reg != "" && instructions[j].opcode != "syscall") live.erase(reg);
+                    vector<string> regs = reads(instructions[j]);
+                    live.insert(regs.begin(), regs.end());
+                }
+                if (live != liveIn[i]) {
+                    liveIn[i] = live;
+                    isChanged = true;
+                }
+            }
+        }
+    }
+};
+
+#endif //HW3_CONTROL_FLOW_HPP
@@ -0,0 +1,218 @@
+#ifndef HW3_DEAD_CODE_HPP
+#define HW3_DEAD_CODE_HPP
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <stdlib.h>
+#include "control_flow.hpp"
+
+using namespace std;
+
+/**
+ * removes the computations whose register is not read before it is written again, and the stores to the
+ * stack slots of variables that are not loaded before they are stored again or the function is left.
+ * a removed instruction may leave the ones that computed its operands dead, so it is repeated until nothing
+ * is removed. the calls, the printing and the jumps are never removed, only the values they do not use.
+ */
+class DeadCodeElimination {
+private:
+    typedef ControlFlowGraph::Instruction Instruction;
+    typedef ControlFlowGraph::Block Block;
+
+    int removedCount;
+    int storesCount;
+    int freedSlotsCount;
+
+    DeadCodeElimination() : removedCount(0), storesCount(0), freedSlotsCount(0) {}
+
+    //the offset of a variable's slot "-offset($fp)" in words, or -1 for any other operand
+    static int localIndex(const string &operand, int firstLocal) {
+        if (ControlFlowGraph::baseRegister(operand) != "$fp" || operand[0] != '-') return -1;
+        int index = atoi(operand.c_str() + 1) / WORD_SIZE;
+        return index >= firstLocal ? index : -1;
+    }
+
+    /**
+     * returns the variables' slot operands of the form "-offset($fp)" in the command, with their positions.
+     */
+    static vector<pair<size_t, string> > findLocals(const string &command, int firstLocal) {
+        vector<pair<size_t, string> > locals;
+        for (size_t found = command.find("($fp)"); found != string::npos; found = command.find("($fp)", found + 1)) {
+            size_t begin = command.find_last_not_of("-0123456789", found - 1) + 1;
+            string operand = command.substr(begin, found + 5 - begin);
+            if (localIndex(operand, firstLocal) != -1) locals.push_back(make_pair(begin, operand));
+        }
+        return locals;
+    }
+
+    static bool isRemovable(const Instruction &instruction) {
+        string reg = ControlFlowGraph::written(instruction);
+        return !instruction.isRemoved && instruction.opcode != "syscall" && reg != "" && reg != "$sp"
+               && reg != "$fp";
+    }
+
+    /**
+     * the variables' slots that may be loaded at the start of every block. a command that is kept as it is
+     * may load any of them.
+     */
+    static vector<set<string> > findLiveSlots(const ControlFlowGraph &graph, const set<string> &allSlots,
+                                              int firstLocal) {
+        vector<set<string> > liveIn(graph.blocks.size());
+        bool isChanged = true;
+        while (isChanged) {
+            isChanged = false;
+            for (int i = graph.blocks.size() - 1; i >= 0; i--) {
+                const Block &block = graph.blocks[i];
+                set<string> live;
+                for (int j = 0; j < block.successors.size(); j++) {
+                    live.insert(liveIn[block.successors[j]].begin(), liveIn[block.successors[j]].end());
+                }
+                for (int j = block.end - 1; j >= block.first; j--) {
+                    stepSlots(graph.instructions[j], live, allSlots, firstLocal);
+                }
+                if (live != liveIn[i]) {
+                    liveIn[i] = live;
+                    isChanged = true;
+                }
+            }
+        }
+        return liveIn;
+    }
+
+    //changes the live slots from after the instruction to before it
+    static void stepSlots(const Instruction &instruction, set<string> &live, const set<string> &allSlots,
+                          int firstLocal) {
+        const string &opcode = instruction.opcode;
+        string base = opcode == "lw" ? ControlFlowGraph::baseRegister(instruction.operands[1]) : "";
+        if (opcode == "sw" && localIndex(instruction.operands[1], firstLocal) != -1) {
+            live.erase(instruction.operands[1]);
+        } else if (base == "$fp") {
+            live.insert(instruction.operands[1]);
+        } else if ((opcode == "lw" && base != "$sp")
+                   || (ControlFlowGraph::isKeptAsIs(instruction) && opcode != "jal" && opcode != "jr")) {
+            //the calls' area under $sp is apart from the variables, a call can not read them
+            live.insert(allSlots.begin(), allSlots.end());
+        }
+    }
+
+    /**
+     * removes the dead instructions of a block, from its end to its start. returns the number removed.
+     */
+    int removeDead(ControlFlowGraph &graph, int block, const set<string> &liveSlotsOut, const set<string> &allSlots,
+                   int firstLocal) {
+        int removed = 0;
+        set<string> live = graph.blocks[block].liveOut;
+        set<string> liveSlots = liveSlotsOut;
+        for (int i = graph.blocks[block].end - 1; i >= graph.blocks[block].first; i--) {
+            Instruction &instruction = graph.instructions[i];
+            if (isRemovable(instruction) && live.count(ControlFlowGraph::written(instruction)) == 0) {
+                instruction.isRemoved = true;
+                removedCount++;
+                removed++;
+                continue;
+            }
+            if (instruction.opcode == "sw" && localIndex(instruction.operands[1], firstLocal) != -1
+                && liveSlots.count(instruction.operands[1]) == 0) {
+                instruction.isRemoved = true;
+                storesCount++;
+                removed++;
+                continue;
+            }
+            string reg = ControlFlowGraph::written(instruction);
+            if (reg != "" && instruction.opcode != "syscall") live.erase(reg);
+            vector<string> regs = graph.reads(instruction);
+            live.insert(regs.begin(), regs.end());
+            stepSlots(instruction, liveSlots, allSlots, firstLocal);
+        }
+        return removed;
+    }
+
+    //removes the dead instructions once, returns the number removed
+    int removeDeadOnce(int functionStart, int functionEnd, int firstLocal, const set<string> &returned) {
+        ControlFlowGraph graph(functionStart, functionEnd, returned, true);
+        if (!graph.isLinked) return 0;
+        set<string> allSlots;
+        for (int address = functionStart; address < functionEnd; address++) {
+            vector<pair<size_t, string> > locals = findLocals(CodeBuffer::instance().getCommand(address), firstLocal);
+            for (int i = 0; i < locals.size(); i++) allSlots.insert(locals[i].second);
+        }
+        vector<set<string> > liveSlotsIn = findLiveSlots(graph, allSlots, firstLocal);
+        int removed = 0;
+        for (int i = 0; i < graph.blocks.size(); i++) {
+            set<string> liveSlotsOut;
+            for (int j = 0; j < graph.blocks[i].successors.size(); j++) {
+                const set<string> &successorSlots = liveSlotsIn[graph.blocks[i].successors[j]];
+                liveSlotsOut.insert(successorSlots.begin(), successorSlots.end());
+            }
+            removed += removeDead(graph, i, liveSlotsOut, allSlots, firstLocal);
+        }
+        graph.rewrite();
+        return removed;
+    }
+
+public:
+    static DeadCodeElimination &getInstance() {
+        static DeadCodeElimination INSTANCE;
+        return INSTANCE;
+    }
+
+    /**
+     * removes the dead instructions of the function's code in [functionStart, functionEnd). the slots of the
+     * variables are the ones [firstLocal] words or more under $fp, and [returned] are the registers the caller
+     * reads after it returns. the stored registers are restored when the function is left, so their values are
+     * dead there.
+     */
+    void optimizeFunction(int functionStart, int functionEnd, int firstLocal, const set<string> &returned) {
+        while (removeDeadOnce(functionStart, functionEnd, firstLocal, returned) > 0) {}
+    }
+
+    /**
+     * moves the variables' slots that are still used to the first ones, and returns the word after the last.
+     */
+    int packLocals(int functionStart, int functionEnd, int firstLocal, int localsEnd) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        set<int> used;
+        for (int address = functionStart; address < functionEnd; address++) {
+            vector<pair<size_t, string> > locals = findLocals(codeBuffer.getCommand(address), firstLocal);
+            for (int i = 0; i < locals.size(); i++) used.insert(localIndex(locals[i].second, firstLocal));
+        }
+        map<int, int> packed;
+        for (set<int>::iterator it = used.begin(); it != used.end(); ++it) {
+            int index = firstLocal + packed.size();
+            packed[*it] = index;
+        }
+        for (int address = functionStart; address < functionEnd; address++) {
+            string command = codeBuffer.getCommand(address);
+            vector<pair<size_t, string> > locals = findLocals(command, firstLocal);
+            if (locals.empty()) continue;
+            //from the last, the positions of the earlier ones stay
+            for (int i = locals.size() - 1; i >= 0; i--) {
+                int index = packed[localIndex(locals[i].second, firstLocal)];
+                command.replace(locals[i].first, locals[i].second.size(),
+                                "-" + AssemblerCoder::to_string(index * WORD_SIZE) + "($fp)");
+            }
+            if (command != codeBuffer.getCommand(address)) codeBuffer.replace(address, command);
+        }
+        int newEnd = firstLocal + packed.size();
+        if (newEnd < localsEnd) freedSlotsCount += localsEnd - newEnd;
+        return newEnd < localsEnd ? newEnd : localsEnd;
+    }
+
+    /**
+     * returns true if the code in [start, end) addresses anything by $fp.
+     */
+    static bool isFramePointerUsed(int start, int end) {
+        for (int address = start; address < end; address++) {
+            if (CodeBuffer::instance().getCommand(address).find("$fp") != string::npos) return true;
+        }
+        return false;
+    }
+
+    void printReport(ostream &out) {
+        out << "removed " << removedCount << " dead computations and " << storesCount << " dead stores, freed "
+            << freedSlotsCount << " stack slots" << endl;
+    }
+};
+
+#endif //HW3_DEAD_CODE_HPP
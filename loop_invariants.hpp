@@ -0,0 +1,337 @@
+#ifndef HW3_LOOP_INVARIANTS_HPP
+#define HW3_LOOP_INVARIANTS_HPP
+#define LOOP_CONSTANTS_MAX (4) //the temporaries that keep constants, the others are left to the expressions
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include "bp.hpp"
+#include "registers.hpp"
+#include "range_analysis.hpp"
+
+using namespace std;
+
+/**
+ * moves the code that computes the same value in every iteration of a loop to the loop's preheader -
+ * a place before the loop's condition that runs once when the loop is entered.
+ * the constants a loop loads are kept in temporaries that are loaded before the outermost loop,
+ * and the multiplications of an induction variable by a constant are replaced by a register that
+ * is advanced with the variable.
+ * the precondition checks of a call whose arguments the loop does not assign are computed in the preheader
+ * into a stored register, and the call only tests it.
+ */
+class LoopInvariants {
+private:
+    struct Loop {
+        int preheaderAddress;
+
+        explicit Loop(int _preheaderAddress) : preheaderAddress(_preheaderAddress) {}
+    };
+
+    //the code that multiplies a variable that lives in [home] by [factor] into [destReg], in [start, end)
+    struct Multiplication {
+        string name;
+        string home;
+        int factor;
+        string destReg;
+        int start;
+        int end;
+
+        Multiplication(string _name, string _home, int _factor, string _destReg, int _start, int _end)
+                : name(_name), home(_home), factor(_factor), destReg(_destReg), start(_start), end(_end) {}
+    };
+
+    //a call at [address] that tests the result of hoisted checks instead of jumping to the checking entry
+    struct CheckedCall {
+        int address;
+        string command;
+        string checkedCommand;
+
+        CheckedCall(int _address, string _command, string _checkedCommand)
+                : address(_address), command(_command), checkedCommand(_checkedCommand) {}
+    };
+
+    //the checks that [code] computes into [flag] in the preheader of loops[loopIndex]
+    struct HoistedCheck {
+        string key;
+        string flag;
+        string code;
+        vector<string> variables; //the variables the checks read, the loop must not assign them
+        int loopIndex;
+        vector<CheckedCall> calls;
+
+        HoistedCheck(string _key, string _flag, string _code, const vector<string> &_variables, int _loopIndex)
+                : key(_key), flag(_flag), code(_code), variables(_variables), loopIndex(_loopIndex), calls() {}
+    };
+
+    vector<Loop> loops; //the loops the code is in, the outermost first
+    map<string, string> constants; //the load of a constant (without the register) and the register that keeps it
+    vector<Multiplication> multiplications;
+    vector<HoistedCheck> hoistedChecks;
+    vector<int> reloadAddresses; //where the constants are loaded again after the calls of the loops
+    vector<string> keptFree; //the temporaries of code that is not emitted yet, like the body of an inlined call
+
+    LoopInvariants() : loops(), constants(), multiplications(), hoistedChecks(), reloadAddresses(), keptFree() {}
+
+    static string to_string(int num) {
+        stringstream ss;
+        ss << num;
+        return ss.str();
+    }
+
+    /**
+     * returns a free temporary that the code from [start] on does not use and that is not kept free, or "".
+     */
+    string findUnusedRegister(int start) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string code;
+        for (int address = start; address < codeBuffer.nextAddress(); address++) {
+            code += codeBuffer.getCommand(address) + "\n";
+        }
+        //the last temporaries are the ones the expressions take last
+        vector<string> free = Registers::getInstance().getFreeTempRegisters();
+        for (int i = free.size() - 1; i >= 0; i--) {
+            if (code.find(free[i]) != string::npos) continue;
+            if (find(keptFree.begin(), keptFree.end(), free[i]) != keptFree.end()) continue;
+            return free[i];
+        }
+        return "";
+    }
+
+    /**
+     * returns the address of the command in [start, end) that writes [reg] first, or -1.
+     */
+    static int findWrite(const string &reg, int start, int end) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        for (int address = start; address < end; address++) {
+            string command = codeBuffer.getCommand(address);
+            size_t operands = command.find(' ');
+            if (operands != string::npos && command.compare(operands + 1, reg.size() + 1, reg + ",") == 0) {
+                return address;
+            }
+        }
+        return -1;
+    }
+
+public:
+    static LoopInvariants &getInstance() {
+        static LoopInvariants INSTANCE;
+        return INSTANCE;
+    }
+
+    static void addToPreheader(int preheaderAddress, const string &command) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string preheader = codeBuffer.getCommand(preheaderAddress);
+        codeBuffer.replace(preheaderAddress, preheader == "" ? command : preheader + "\n" + command);
+    }
+
+    /**
+     * no constant is kept in [regs] until it is called again, the code that uses them is emitted later.
+     */
+    void keepFree(const vector<string> &regs) {
+        keptFree = regs;
+    }
+
+    void startLoop(int preheaderAddress) {
+        loops.push_back(Loop(preheaderAddress));
+    }
+
+    /**
+     * puts back the calls that test hoisted checks whose variables the ending loop assigns.
+     */
+    void verifyHoistedChecks() {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int loopIndex = loops.size() - 1;
+        for (int i = 0; i < hoistedChecks.size(); i++) {
+            HoistedCheck &hoistedCheck = hoistedChecks[i];
+            if (hoistedCheck.loopIndex != loopIndex) continue;
+            int preheaderAddress = loops[loopIndex].preheaderAddress;
+            bool isInvariant = true;
+            for (int j = 0; j < hoistedCheck.variables.size(); j++) {
+                RangeAnalysis &rangeAnalysis = RangeAnalysis::getInstance();
+                if (rangeAnalysis.countAssignments(hoistedCheck.variables[j], preheaderAddress, codeBuffer.nextAddress()) > 0) {
+                    isInvariant = false;
+                }
+            }
+            if (!isInvariant) {
+                //the code is removed with the new line that joined it to the preheader
+                string preheader = codeBuffer.getCommand(preheaderAddress);
+                size_t start = preheader.find(hoistedCheck.code);
+                size_t length = hoistedCheck.code.size();
+                if (start > 0) {
+                    start--;
+                    length++;
+                } else if (length < preheader.size()) {
+                    length++;
+                }
+                codeBuffer.replace(preheaderAddress, preheader.erase(start, length));
+                for (int j = 0; j < hoistedCheck.calls.size(); j++) {
+                    CheckedCall &call = hoistedCheck.calls[j];
+                    //a tail call jumps to the checking entry anyway
+                    if (codeBuffer.getCommand(call.address) == call.checkedCommand) {
+                        codeBuffer.replace(call.address, call.command);
+                    }
+                }
+            }
+            Registers::getInstance().homeFree(hoistedCheck.flag);
+            hoistedChecks.erase(hoistedChecks.begin() + i);
+            i--;
+        }
+    }
+
+    /**
+     * the constants are kept until the outermost loop ends.
+     */
+    void endLoop() {
+        verifyHoistedChecks();
+        loops.pop_back();
+        if (!loops.empty()) return;
+        for (map<string, string>::iterator it = constants.begin(); it != constants.end(); ++it) {
+            Registers::getInstance().homeFree(it->second);
+        }
+        constants.clear();
+        multiplications.clear();
+        reloadAddresses.clear();
+    }
+
+    /**
+     * returns a register that holds the constant "[opcode] <reg>, [operand]" loads for the whole loop,
+     * or "" if the code is not in a loop or no register can keep it.
+     */
+    string loadConstant(const string &opcode, const string &operand) {
+        if (loops.empty()) return "";
+        string load = opcode + " " + operand;
+        if (constants.count(load)) return constants[load];
+        if (constants.size() == LOOP_CONSTANTS_MAX) return "";
+        string reg = findUnusedRegister(loops[0].preheaderAddress);
+        if (reg == "") return "";
+        Registers::getInstance().reserve(reg);
+        constants[load] = reg;
+        addToPreheader(loops[0].preheaderAddress, opcode + " " + reg + ", " + operand);
+        //the calls before it in the loop run again after it in the next iteration
+        for (int i = 0; i < reloadAddresses.size(); i++) {
+            addToPreheader(reloadAddresses[i], opcode + " " + reg + ", " + operand);
+        }
+        return reg;
+    }
+
+    /**
+     * the registers of the constants, a call does not keep them.
+     */
+    vector<string> constantRegisters() {
+        vector<string> regs;
+        for (map<string, string>::iterator it = constants.begin(); it != constants.end(); ++it) {
+            regs.push_back(it->second);
+        }
+        return regs;
+    }
+
+    /**
+     * loads the constants again after a call, it is cheaper than saving them around it. the constants the loop
+     * loads later are added to it too.
+     */
+    void reloadConstants() {
+        if (loops.empty()) return;
+        string loads;
+        for (map<string, string>::iterator it = constants.begin(); it != constants.end(); ++it) {
+            string load = it->first;
+            size_t operand = load.find(' ');
+            if (loads != "") loads += "\n";
+            loads += load.substr(0, operand) + " " + it->second + ", " + load.substr(operand + 1);
+        }
+        reloadAddresses.push_back(CodeBuffer::instance().emit(loads));
+    }
+
+    /**
+     * computes [checks] in the preheader of the innermost loop into a stored register, [checks] jumps to
+     * [failLabel] when they fail and the call at [callAddress] then jumps to [errorLabel] instead of [target].
+     * the checks are computed once for all the calls with the same [key].
+     * the variables the checks read must not be assigned in the loop, it is verified when the loop ends.
+     * returns false if the code is not in a loop or no stored register is free.
+     */
+    bool hoistCheck(const string &key, const string &checks, const string &failLabel, const vector<string> &variables,
+                    int callAddress, const string &target, const string &newTarget, const string &errorLabel) {
+        if (loops.empty()) return false;
+        int loopIndex = loops.size() - 1;
+        HoistedCheck *hoistedCheck = NULL;
+        for (int i = 0; i < hoistedChecks.size(); i++) {
+            if (hoistedChecks[i].key == key && hoistedChecks[i].loopIndex == loopIndex) hoistedCheck = &hoistedChecks[i];
+        }
+        if (hoistedCheck == NULL) {
+            //the temporaries are free again after the checks, only the constants must be kept
+            map<string, string> substitutes;
+            vector<string> free = Registers::getInstance().getFreeTempRegisters();
+            for (int i = 0; i < TEMP_REG_END; i++) {
+                string reg = "$t" + to_string(i);
+                if (checks.find(reg) == string::npos) continue;
+                if (free.empty()) return false;
+                substitutes[reg] = free.back();
+                free.pop_back();
+            }
+            string flag = Registers::getInstance().homeAlloc();
+            if (flag == "") return false;
+            string code = "li " + flag + ", 0\n" + Registers::rename(checks, substitutes) + "\nli " + flag + ", 1\n" +
+                          failLabel + ":\n#end of the hoisted checks";
+            addToPreheader(loops[loopIndex].preheaderAddress, code);
+            hoistedChecks.push_back(HoistedCheck(key, flag, code, variables, loopIndex));
+            hoistedCheck = &hoistedChecks.back();
+        }
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string command = codeBuffer.getCommand(callAddress);
+        string checkedCommand = "beq " + hoistedCheck->flag + ", $0, " + errorLabel + "\n" +
+                                command.substr(0, command.size() - target.size()) + newTarget;
+        codeBuffer.replace(callAddress, checkedCommand);
+        hoistedCheck->calls.push_back(CheckedCall(callAddress, command, checkedCommand));
+        return true;
+    }
+
+    /**
+     * records the multiplication of the variable [name] that lives in [home], emitted from [start] on.
+     */
+    void addMultiplication(const string &name, const string &home, int factor, const string &destReg, int start) {
+        if (loops.empty()) return;
+        int end = CodeBuffer::instance().nextAddress();
+        //a single instruction costs as much as copying the reduced value
+        if (end - start < 2) return;
+        multiplications.push_back(Multiplication(name, home, factor, destReg, start, end));
+    }
+
+    /**
+     * replaces the multiplications of the variable [name] in the loop by a register that is set in the loop's
+     * preheader and advanced by the command at [incrementAddress], that adds [step] to the variable.
+     * the code of the loop (from the preheader on) must not call functions, they do not keep the register.
+     */
+    void reduceMultiplications(const string &name, int step, int incrementAddress, int preheaderAddress) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        map<int, string> reduced; //the factor and the register that keeps the multiplication by it
+        for (int i = 0; i < multiplications.size(); i++) {
+            Multiplication &multiplication = multiplications[i];
+            if (multiplication.name != name || multiplication.start < preheaderAddress) continue;
+            int increment = findWrite(multiplication.home, incrementAddress, codeBuffer.nextAddress());
+            if (increment == -1) return;
+            if (reduced.count(multiplication.factor) == 0) {
+                string reg = findUnusedRegister(preheaderAddress);
+                if (reg == "") return;
+                reduced[multiplication.factor] = reg;
+                map<string, string> substitutes;
+                substitutes[multiplication.destReg] = reg;
+                for (int address = multiplication.start; address < multiplication.end; address++) {
+                    addToPreheader(preheaderAddress, Registers::rename(codeBuffer.getCommand(address), substitutes));
+                }
+                //the product wraps around like the multiplication does
+                int advance = (int) ((unsigned int) multiplication.factor * (unsigned int) step);
+                codeBuffer.replace(increment, codeBuffer.getCommand(increment) + "\naddu " + reg + ", " + reg + ", " +
+                                              to_string(advance));
+            }
+            codeBuffer.replace(multiplication.start, "move " + multiplication.destReg + ", " + reduced[multiplication.factor]);
+            for (int address = multiplication.start + 1; address < multiplication.end; address++) {
+                codeBuffer.replace(address, "");
+            }
+            multiplications.erase(multiplications.begin() + i);
+            i--;
+        }
+    }
+};
+
+#endif //HW3_LOOP_INVARIANTS_HPP
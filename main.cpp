@@ -1,5 +1,6 @@
 #include <iostream>
 #include <stdlib.h>
+#include <map>
 #include "main.hpp"
 #include <assert.h>     /* assert */
 #include "registers.hpp"
@@ -8,12 +9,47 @@
 #include "parser.hpp"
 
 #define PRECOND_ERR_LABEL_PREFIX "precond_err_"
+#define PRECOND_ERROR_LABEL "precond_error" //prints the error for the name of the function in $a1 and exits
+#define UNCHECKED_ENTRY_SUFFIX "_unchecked" //the entry of a function after its precondition checks
+#define CHECK_LABEL_INFIX "_check_" //the labels of the copies of a function's checks
+#define INLINE_MAX_COMMANDS (16) //functions up to this size cost less to copy into their call sites than to call
+#define FRAME_HEADER_SIZE (2 + STORED_REG_END - STORED_REG_START) //$fp, $ra and the stored registers
+#define ROTATE_MAX_COMMANDS (16) //longer loop conditions are jumped back to instead of copied to the bottom
+#define UNROLL_FACTOR (4) //the iterations an unrolled loop runs between its tests, unless --unroll sets it
+#define UNROLL_MAX_COMMANDS (32)
 using namespace std;
 
 namespace FanC {
     vector<Scope *> symbolTable;
     vector<int> offsets;
     bool isMainExist = false;
+    //the places of the current function's prologue and epilogues, filled at the end of the function
+    int entryChecksAddress; //before the prologue, where the checks of the preconditions are moved
+    int prologueAddress;
+    int preConditionsAddress;
+    vector<int> selfTailCallAddresses; //recursions in a tail position that did not prove the preconditions
+    vector<int> epilogueAddresses;
+    bool isLeafFunction;
+    bool needsFramePointer;
+    int localsEnd; //the offset after the last stack slot a variable of the function took
+    int callAreaSize; //the slots at the bottom of the frame that the calls use, addressed by $sp
+    int firstCallAddress; //where the frame is set up when the code before the first call can do without it
+    int lastCallAddress;
+    vector<int> tailCallAddresses;
+    string functionEntryLabel; //after the frame setup, where the arguments are moved to their homes
+    vector<string> argumentHomes;
+    map<Id *, int> zeroInitAddresses; //the initializations of the declared variables that were not read yet
+
+    vector<InductionStep> inductionSteps;
+    int unrollFactor = UNROLL_FACTOR;
+    bool isConstantPropagation = true;
+    bool isValueNumbering = true;
+    bool isDeadCodeElimination = true;
+    bool isPreConditionErrorEmitted = false;
+    vector<string> functionLabels; //the labels the functions and the runtime routines start at
+    vector<pair<string, int> > functionStarts; //the functions' names and the addresses of their labels
+    bool isX86Target = false;
+    string emittedFormat = "asm";
 
     void checkAndNotifyIfMain(Id *id, FormalList *formals, ReturnType *returnType) {
 
@@ -110,7 +146,16 @@ namespace FanC {
             delete strVec;
             exit(1);
         }
-        return new Call(func->returnType, id, expList);
+        int callAddress = CodeBuffer::instance().emit(""); //the frame may be set up here, see shrinkWrapFrame
+        Call *call = new Call(func->returnType, id, expList, func->inlineBody);
+        if (!call->isInlined) {
+            if (isLeafFunction) firstCallAddress = callAddress;
+            lastCallAddress = callAddress;
+            isLeafFunction = false;
+            callAreaSize = max(callAreaSize, call->frameSlots);
+            checkPreConditionsAtCall(func, call);
+        }
+        return call;
     }
 
     /*
@@ -139,8 +184,13 @@ namespace FanC {
 
         assertIdentifierNotExists(id);
         int newOffset = offsets.back();
-        offsets.pop_back();
-        offsets.push_back(newOffset + 1);
+        id->homeRegister = Registers::getInstance().homeAlloc();
+        if (id->homeRegister == "") { //no free register - the variable gets a place in the stack
+            offsets.pop_back();
+            offsets.push_back(newOffset + 1);
+            localsEnd = max(localsEnd, newOffset + 1);
+            needsFramePointer = true;
+        }
         id->offset = newOffset;
         symbolTable.back()->addVariable(id);
     }
@@ -155,15 +205,24 @@ namespace FanC {
 
     void handleArgumentDecl(FormalList *formalList) {
 
+        /* the first arguments are passed in registers, their offsets only mark them as arguments.
+         * the rest are in the stack above the frame pointer */
         int offset = -1;
+        int index = 0;
         vector<FormalDec *>::iterator it = formalList->decelerations.begin();
         while (formalList->decelerations.end() != it) {
             FormalDec *formalDec = *it;
             assertIdentifierNotExists(formalDec->id);
             Id *id = new Id(formalDec->id);
+            if (index == ARGUMENT_REG_NUM) {
+                offset = -1;
+                needsFramePointer = true;
+            }
             id->offset = offset;
+            id->homeRegister = Registers::getInstance().homeAlloc();
             symbolTable.back()->addVariable(id);
             --offset;
+            ++index;
             ++it;
         }
     }
@@ -185,20 +244,44 @@ namespace FanC {
     void handleIDExpression(Id *id) {
 
         Id *idFromSymbolTable = extractIdFromSymbolTable(id);
-        id->registerName = getRegister(id);
+        zeroInitAddresses.erase(idFromSymbolTable);
         id->type= idFromSymbolTable->type->clone();
         id->offset = idFromSymbolTable->offset;
+        id->homeRegister = idFromSymbolTable->homeRegister;
+        VariableFact *fact = symbolTable.back()->getFact(id->name);
+        if (NULL != fact) {
+            id->knownRange = fact->range;
+            id->knownRange.reasons.push_back(Reason(id->name, fact->address, CodeBuffer::instance().nextAddress()));
+        }
         if(id->isBoolean()){
-            int bneAdd = AssemblerCoder::getInstance().bne("$0",id->registerName);
+            //numeric ids are loaded only when their value is consumed
+            string regName = getRegister(id);
+            int bneAdd = AssemblerCoder::getInstance().bne("$0",regName);
+            id->branchAddress = bneAdd;
+            id->testedRegister = regName;
             id->trueList = CodeBuffer::instance().makelist(bneAdd);
             id->falseList = CodeBuffer::instance().makelist(AssemblerCoder::getInstance().j());
+            Registers::getInstance().regFree(regName);
+            id->registerName = "";
         }
     }
 
     void saveRegisterToStack(Id *id, Expression *exp) {
+        int step;
+        if (exp->isIncrementOf(id->name, step)) {
+            inductionSteps.push_back(InductionStep(id->name, step, CodeBuffer::instance().nextAddress(),
+                                                   symbolTable.size()));
+        }
+        learnAssignment(id, exp);
+        removeZeroInit(id);
         changeBranchToVar(exp);//must be before saving to stack
-        AssemblerCoder::getInstance().sw(exp->registerName,id->offset*(-WORD_SIZE),"$fp");
-        Registers::getInstance().regFree(exp->registerName);
+        if (id->homeRegister != "") {
+            exp->evaluateTo(id->homeRegister);
+            return;
+        }
+        string regName = exp->evaluate();
+        AssemblerCoder::getInstance().sw(regName,id->offset*(-WORD_SIZE),"$fp");
+        Registers::getInstance().regFree(regName);
     }
 
 
@@ -222,6 +305,7 @@ namespace FanC {
         symbolTable.push_back(new Scope(symbolTable.back()));
         offsets.push_back(offsets.back());
         validateExpIsBool(exp);
+        learnConditionFacts(exp);
         //delete exp;
     }
 
@@ -249,11 +333,41 @@ namespace FanC {
     void reduceFuncDecl(FuncDec *funDec, Expression *tempExp, Statements *statements) {
         reduceEndScope();
         AssemblerCoder &assembler = AssemblerCoder::getInstance();
-        assembler.addu("$sp","$fp",WORD_SIZE);
         if(funDec->id->name == "main") assembler.exit();
-        else assembler.jr();
+        else if (!endsWithReturn()) {
+            epilogueAddresses.push_back(CodeBuffer::instance().emit(""));
+            assembler.jr();
+        }
         delete statements;
-        CodeBuffer::instance().bpatch(tempExp->falseList,(string)PRECOND_ERR_LABEL_PREFIX+funDec->id->name);
+        RangeAnalysis::getInstance().endFunction();
+        //the checks that may move before the prologue are left out, the body must not rely on their values
+        int bodyStart = funDec->entryChecks.empty() ? prologueAddress + 1
+                                                    : funDec->entryChecksAddress + funDec->entryChecks.size();
+        //the caller reads the returned value, main exits the program
+        set<string> returned;
+        if (!isInstanceOf<Void>(funDec->returnType)) returned.insert("$v0");
+        if (isConstantPropagation) {
+            ConstantPropagation::getInstance().optimizeFunction(bodyStart, CodeBuffer::instance().nextAddress());
+        }
+        if (isValueNumbering) {
+            ValueNumbering::getInstance().optimizeFunction(bodyStart, CodeBuffer::instance().nextAddress(), returned);
+        }
+        if (isDeadCodeElimination) {
+            DeadCodeElimination &deadCode = DeadCodeElimination::getInstance();
+            int end = CodeBuffer::instance().nextAddress();
+            deadCode.optimizeFunction(bodyStart, end, FRAME_HEADER_SIZE, returned);
+            localsEnd = deadCode.packLocals(bodyStart, end, FRAME_HEADER_SIZE, localsEnd);
+            needsFramePointer = needsFramePointer && DeadCodeElimination::isFramePointerUsed(prologueAddress + 1, end);
+        }
+        bool isFrameless = fillFrame(funDec->id);
+        //a small function keeps its checks in its body, to be copied with it
+        funDec->hasUncheckedEntry = !isFrameless && !funDec->entryChecks.empty();
+        if (funDec->hasUncheckedEntry) addChecksToSelfTailCalls(funDec);
+        layoutBranches(prologueAddress);
+        if (isFrameless) keepInlineBody(funDec);
+        moveEntryChecks(funDec);
+        //the error block is out of the way of the function's code
+        if (funDec->conditions->size() > 0) addPreConditionErrorBlock(funDec->id);
         delete tempExp;
         //delete funDec;
     }
@@ -282,7 +396,13 @@ namespace FanC {
         for(int i=0;i<preconditions->preconditions.size();i++){
             PreCondition* preCondition=preconditions->preconditions[i];
             falseExp->falseList=codeBuffer.merge(falseExp->falseList,preCondition->exp->falseList);
+            //the body runs only when the preconditions hold
+            learnConditionFacts(preCondition->exp);
         }
+        codeBuffer.bpatch(falseExp->falseList,(string)PRECOND_ERR_LABEL_PREFIX+functionScope->func->id->name);
+        falseExp->falseList.clear();
+        layoutBranches(preConditionsAddress);
+        recordEntryChecks(functionScope->func);
         return falseExp;
     }
 
@@ -296,6 +416,7 @@ namespace FanC {
         validateExpIsBool(exp);
         symbolTable.push_back(new WhileScope(symbolTable.back()));
         offsets.push_back(offsets.back());
+        learnConditionFacts(exp);
         //delete exp;
     }
 
@@ -308,10 +429,14 @@ namespace FanC {
             FormalList *printArguments = new FormalList(new FormalDec(new StringType(), NULL));
             FuncDec *printDec = new FuncDec(new Void(), new Id("print", new Void(), FunctionType), printArguments,
                                             NULL);
+            printDec->inlineBody.push_back("li $v0, 4");
+            printDec->inlineBody.push_back("syscall");
             symbolTable.back()->addFunction(printDec);
             FormalList *printIArguments = new FormalList(new FormalDec(new IntType(), NULL));
             FuncDec *printIDec = new FuncDec(new Void(), new Id("printi", new Void(), FunctionType), printIArguments,
                                              NULL);
+            printIDec->inlineBody.push_back("li $v0, 1");
+            printIDec->inlineBody.push_back("syscall");
             symbolTable.back()->addFunction(printIDec);
         } else {
             symbolTable.push_back(new Scope(symbolTable.back()));
@@ -327,7 +452,134 @@ namespace FanC {
     void reduceOpenFunctionScope() {
 
         symbolTable.push_back(new FunctionScope(symbolTable.back()));
-        offsets.push_back(offsets.back());
+        /* the frame starts with the caller's $fp, $ra and the stored registers the function uses.
+         * variables get a place in the stack only when all the stored registers are taken,
+         * so their offsets start after a full frame header */
+        offsets.push_back(FRAME_HEADER_SIZE);
+        Registers::getInstance().startFunction();
+        epilogueAddresses.clear();
+        RangeAnalysis::getInstance().startFunction();
+        inductionSteps.clear();
+        isLeafFunction = true;
+        needsFramePointer = false;
+        localsEnd = FRAME_HEADER_SIZE;
+        callAreaSize = 0;
+        firstCallAddress = -1;
+        lastCallAddress = -1;
+        tailCallAddresses.clear();
+        selfTailCallAddresses.clear();
+        argumentHomes.clear();
+    }
+
+    bool fillFrame(Id *funcId) {
+        vector<string> regs = Registers::getInstance().getTouchedStoredRegisters();
+        string prologue, epilogue;
+        /* the whole frame is allocated here and $sp does not move inside the function body:
+         * the header and the variables are on top, the calls' arguments and saved registers at the bottom */
+        if (funcId->name == "main") {
+            //main does not return to a caller, nothing to save
+            if (needsFramePointer) {
+                int frameSize = WORD_SIZE * (localsEnd - 1 + callAreaSize);
+                prologue = "move $fp, $sp\nsubu $sp, $sp, " + AssemblerCoder::to_string(frameSize);
+            } else if (callAreaSize > 0) {
+                prologue = "subu $sp, $sp, " + AssemblerCoder::to_string(WORD_SIZE * callAreaSize);
+            }
+        } else if (needsFramePointer) {
+            /* $fp points to the first slot of the header, right under the arguments in the stack:
+             * caller's $fp at 0($fp), $ra at -4($fp), the stored registers after them and then the variables */
+            int headerSize = 2 + regs.size();
+            int frameSize = WORD_SIZE * ((localsEnd > FRAME_HEADER_SIZE ? localsEnd : headerSize) + callAreaSize);
+            prologue = "subu $sp, $sp, " + AssemblerCoder::to_string(frameSize);
+            prologue += "\nsw $fp, " + AssemblerCoder::to_string(frameSize - WORD_SIZE) + "($sp)";
+            if (!isLeafFunction) {
+                prologue += "\nsw $ra, " + AssemblerCoder::to_string(frameSize - 2 * WORD_SIZE) + "($sp)";
+                epilogue += "lw $ra, -4($fp)\n";
+            }
+            for (int i = 0; i < regs.size(); i++) {
+                prologue += "\nsw " + regs[i] + ", " + AssemblerCoder::to_string(frameSize - WORD_SIZE * (3 + i)) + "($sp)";
+                epilogue += "lw " + regs[i] + ", " + AssemblerCoder::to_string(-WORD_SIZE * (i + 2)) + "($fp)\n";
+            }
+            prologue += "\naddu $fp, $sp, " + AssemblerCoder::to_string(frameSize - WORD_SIZE);
+            epilogue += "addu $sp, $fp, " + AssemblerCoder::to_string(WORD_SIZE);
+            epilogue += "\nlw $fp, " + AssemblerCoder::to_string(-WORD_SIZE) + "($sp)";
+        } else {
+            //the header is addressed by $sp, above the calls' area
+            vector<string> saved = regs;
+            if (!isLeafFunction) saved.insert(saved.begin(), "$ra");
+            if (!saved.empty()) {
+                string frameSize = AssemblerCoder::to_string(WORD_SIZE * (callAreaSize + saved.size()));
+                prologue = "subu $sp, $sp, " + frameSize;
+                for (int i = 0; i < saved.size(); i++) {
+                    string address = AssemblerCoder::to_string(WORD_SIZE * (callAreaSize + i)) + "($sp)";
+                    prologue += "\nsw " + saved[i] + ", " + address;
+                    epilogue += "lw " + saved[i] + ", " + address + "\n";
+                }
+                epilogue += "addu $sp, $sp, " + frameSize;
+            }
+            if (shrinkWrapFrame(prologue, epilogue)) return isLeafFunction;
+        }
+        CodeBuffer::instance().replace(prologueAddress, prologue);
+        for (int i = 0; i < epilogueAddresses.size(); i++) {
+            CodeBuffer::instance().replace(epilogueAddresses[i], epilogue);
+        }
+        fillTailCalls(epilogue);
+        return false;
+    }
+
+    void fillTailCalls(const string &epilogue) {
+        for (int i = 0; i < tailCallAddresses.size(); i++) {
+            string jump = CodeBuffer::instance().getCommand(tailCallAddresses[i]);
+            CodeBuffer::instance().replace(tailCallAddresses[i], epilogue == "" ? jump : epilogue + "\n" + jump);
+        }
+    }
+
+    bool compileTailCall(Expression *exp) {
+        Call *call = dynamic_cast<Call *>(exp);
+        if (call == NULL || !call->isTailCallable()) return false;
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        //the handling of the returned value is not needed, the function returns it directly to our caller
+        for (int address = call->jalAddress + 1; address < codeBuffer.nextAddress(); address++) {
+            codeBuffer.replace(address, "");
+        }
+        if (call->registerName != "") {
+            Registers::getInstance().regFree(call->registerName);
+            call->registerName = "";
+        }
+        if (*getFunction()->id == *call->id) {
+            //a recursion in a tail position is a loop, the arguments are already in place for the next iteration
+            string target = codeBuffer.getCommand(call->jalAddress).substr(4);
+            if (getFunction()->conditions->size() > 0 && target == call->id->name) {
+                selfTailCallAddresses.push_back(call->jalAddress);
+            }
+            codeBuffer.replace(call->jalAddress, "j " + functionEntryLabel);
+            if (firstCallAddress == lastCallAddress) {
+                //it was the only call
+                firstCallAddress = -1;
+                isLeafFunction = true;
+            }
+        } else {
+            codeBuffer.replace(call->jalAddress, "j " + call->id->name);
+            tailCallAddresses.push_back(call->jalAddress);
+        }
+        return true;
+    }
+
+    void keepInlineBody(FuncDec *funDec) {
+        if (funDec->arguments->decelerations.size() > ARGUMENT_REG_NUM) return;
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int start = prologueAddress + 1;
+        int size = 0;
+        vector<string> body;
+        for (int address = start; address < codeBuffer.nextAddress(); address++) {
+            string command = codeBuffer.getCommand(address);
+            if (isInstruction(command)) {
+                size += 1 + count(command.begin(), command.end(), '\n');
+            }
+            body.push_back(CodeBuffer::relocateLabels(command, -start));
+        }
+        if (size <= Profile::getInstance().inlineLimit(funDec->id->name, INLINE_MAX_COMMANDS)) {
+            funDec->inlineBody = body;
+        }
     }
 
     int reduceEndScope() {
@@ -343,15 +595,170 @@ namespace FanC {
             numVarsAfter= offsets.back();
 
         currentScope->endScope();
+        for (vector<Id *>::iterator it = currentScope->variables.begin(); it != currentScope->variables.end(); ++it) {
+            if ((*it)->homeRegister != "") Registers::getInstance().homeFree((*it)->homeRegister);
+            zeroInitAddresses.erase(*it);
+        }
         delete currentScope;
         return numVarsBefore - numVarsAfter;
     }
 
 
+    bool shrinkWrapFrame(const string &prologue, const string &epilogue) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int end = codeBuffer.nextAddress();
+        int split = firstCallAddress == -1 ? end : firstCallAddress;
+        //the code before the split must not be reachable from the code after it
+        for (int address = split; address < end; address++) {
+            int target = jumpTarget(codeBuffer.getCommand(address));
+            if (target > prologueAddress && target < split) return false;
+        }
+
+        /* before the split the stored registers' values are kept in registers that need no saving:
+         * the arguments stay where they were passed and the other variables take unused temporaries */
+        map<string, string> substitutes;
+        string prefixCode;
+        for (int address = prologueAddress + 1; address < split; address++) {
+            prefixCode += codeBuffer.getCommand(address) + "\n";
+        }
+        vector<string> spareRegs;
+        for (int i = 0; i < ARGUMENT_REG_NUM; i++) {
+            string reg = Registers::argumentRegister(i);
+            size_t found = prefixCode.find(reg);
+            if (found == string::npos) {
+                spareRegs.push_back(reg);
+            } else if (i < argumentHomes.size() && argumentHomes[i] != ""
+                       && prefixCode.find(reg, found + 1) == string::npos
+                       && isArgumentCopy(prefixCode, found, argumentHomes[i], reg)) {
+                //only read where the argument is copied to its home. any other use of it, like the la $a0 of an
+                //inlined print, keeps it
+                substitutes[argumentHomes[i]] = reg;
+            }
+        }
+        for (int i = 0; i < TEMP_REG_END; i++) {
+            string reg = "$t" + AssemblerCoder::to_string(i);
+            if (prefixCode.find(reg) == string::npos) spareRegs.push_back(reg);
+        }
+        for (int i = 0; i < STORED_REG_END - STORED_REG_START; i++) {
+            string reg = "$s" + AssemblerCoder::to_string(i);
+            if (prefixCode.find(reg) == string::npos || substitutes.count(reg)) continue;
+            if (spareRegs.empty()) return false;
+            substitutes[reg] = spareRegs.back();
+            spareRegs.pop_back();
+        }
+
+        for (int address = prologueAddress + 1; address < split; address++) {
+            string command = Registers::rename(codeBuffer.getCommand(address), substitutes);
+            string copied = command.substr(command.find(' ') + 1);
+            if (command.find("move ") == 0 && copied.substr(0, copied.find(',')) == copied.substr(copied.find(", ") + 2)) {
+                command = ""; //the value is already in place
+            }
+            codeBuffer.replace(address, command);
+        }
+        string frameSetup = prologue;
+        for (map<string, string>::iterator it = substitutes.begin(); it != substitutes.end(); ++it) {
+            frameSetup += "\nmove " + it->first + ", " + it->second;
+        }
+        codeBuffer.replace(prologueAddress, "");
+        for (int i = 0; i < epilogueAddresses.size(); i++) {
+            codeBuffer.replace(epilogueAddresses[i], epilogueAddresses[i] < split ? "" : epilogue);
+        }
+        fillTailCalls(epilogue); //a tail call is a call, so it is never before the split
+        if (split == end) return true;
+        codeBuffer.replace(split, frameSetup);
+
+        //jumps that skip over the split set up the frame on their way
+        map<int, string> setupLabels;
+        for (int address = prologueAddress + 1; address < split; address++) {
+            string command = codeBuffer.getCommand(address);
+            int target = jumpTarget(command);
+            if (target < split || target >= end) continue;
+            if (setupLabels.count(target) == 0) {
+                setupLabels[target] = codeBuffer.genLabel();
+                codeBuffer.emit(frameSetup);
+                AssemblerCoder::getInstance().j("label_" + AssemblerCoder::to_string(target));
+            }
+            codeBuffer.replace(address, command.substr(0, command.rfind("label_")) + setupLabels[target]);
+        }
+        return true;
+    }
+
+    //true if the line of the code at [found] is "move <home>, <reg>"
+    bool isArgumentCopy(const string &code, size_t found, const string &home, const string &reg) {
+        size_t lineStart = code.rfind('\n', found);
+        lineStart = lineStart == string::npos ? 0 : lineStart + 1;
+        return code.substr(lineStart, code.find('\n', found) - lineStart) == "move " + home + ", " + reg;
+    }
+
+    int jumpTarget(const string &command) {
+        if (command.find("jal ") == 0 || (command.find("j ") != 0 && command.find('b') != 0)) return -1;
+        size_t labelStart = command.rfind(' ') + 1;
+        if (command.find("label_", labelStart) != labelStart) return -1;
+        return atoi(command.substr(labelStart + 6).c_str());
+    }
+
+    bool endsWithReturn() {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        for (int address = codeBuffer.nextAddress() - 1; address > prologueAddress; address--) {
+            string command = codeBuffer.getCommand(address);
+            if (command == "" || command[0] == '#') continue;
+            //a label may be jumped to, the code after it still has to return
+            return command == "jr $ra";
+        }
+        return false;
+    }
+
+    bool isInstruction(const string &command) {
+        return command != "" && command[0] != '#' && command[command.size() - 1] != ':';
+    }
+
+    bool fallsThrough(int address, int target) {
+        if (target <= address) return false;
+        for (int i = address + 1; i < target; i++) {
+            if (isInstruction(CodeBuffer::instance().getCommand(i))) return false;
+        }
+        return true;
+    }
+
+    void layoutBranches(int start) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        for (int address = start; address < codeBuffer.nextAddress(); address++) {
+            string command = codeBuffer.getCommand(address);
+            int target = jumpTarget(command);
+            if (target == -1 || command.find('\n') != string::npos) continue;
+            if (fallsThrough(address, target)) {
+                codeBuffer.replace(address, "");
+                continue;
+            }
+            //a branch over the jump to its false label: "bXX L1; j L2; L1:" becomes "b(not XX) L2; L1:"
+            int next = address + 1;
+            string nextCommand;
+            for (; next < codeBuffer.nextAddress(); next++) {
+                nextCommand = codeBuffer.getCommand(next);
+                if (nextCommand != "" && nextCommand[0] != '#') break; //an instruction or a label
+            }
+            if (nextCommand.find("j ") != 0 || nextCommand.find('\n') != string::npos) continue;
+            if (!fallsThrough(next, target)) continue;
+            string inverted = AssemblerCoder::invertBranch(command, nextCommand.substr(2));
+            if (inverted == "") continue;
+            codeBuffer.replace(address, inverted);
+            codeBuffer.replace(next, "");
+        }
+    }
+
     void foldScope(){
-        int numVars = reduceEndScope();
-        AssemblerCoder::getInstance().comment("return sp to the start of this scope");
-        AssemblerCoder::getInstance().addu("$sp","$sp",WORD_SIZE*numVars);
+        //the variables' stack slots are part of the function's frame, the scope only frees their offsets
+        reduceEndScope();
+    }
+
+    void removeZeroInit(Id *id) {
+        map<Id *, int>::iterator it = zeroInitAddresses.find(id);
+        if (it == zeroInitAddresses.end()) return;
+        vector<Id *> &variables = symbolTable.back()->variables;
+        if (find(variables.begin(), variables.end(), id) != variables.end()) {
+            CodeBuffer::instance().replace(it->second, "");
+        }
+        zeroInitAddresses.erase(it);
     }
 
     void reduceStatement() {
@@ -372,15 +779,157 @@ namespace FanC {
             exit(1);
         }
         reduceEndScope();
+        Profile &profile = Profile::getInstance();
+        if (profile.isInstrumenting()) {
+            functionLabels.push_back(PROFILE_DUMP_LABEL);
+            profile.instrumentProgram(functionStarts);
+        } else if (profile.isLoaded()) {
+            profile.layoutProgram(functionStarts);
+        }
+    }
+
+    M *reduceLoopEntry() {
+        LoopInvariants::getInstance().startLoop(CodeBuffer::instance().emit(""));
+        return new M();
+    }
+
+    int labelAddress(M *marker) {
+        return atoi(marker->label.substr(6).c_str());
+    }
+
+    bool canCopyCode(int start, int end, int maxCommands) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int size = 0;
+        for (int address = start; address < end; address++) {
+            string command = codeBuffer.getCommand(address);
+            //calls, returns and tail calls are completed later by their addresses
+            if (command.find("jal ") != string::npos) return false;
+            if (find(epilogueAddresses.begin(), epilogueAddresses.end(), address) != epilogueAddresses.end() ||
+                find(tailCallAddresses.begin(), tailCallAddresses.end(), address) != tailCallAddresses.end()) {
+                return false;
+            }
+            if (isInstruction(command)) size += 1 + count(command.begin(), command.end(), '\n');
+        }
+        return size <= maxCommands;
+    }
+
+    int copyCode(int start, int end) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int offset = codeBuffer.nextAddress() - start;
+        for (int address = start; address < end; address++) {
+            codeBuffer.emit(CodeBuffer::relocateLabels(codeBuffer.getCommand(address), offset, start, end));
+        }
+        return offset;
+    }
+
+    InductionStep *findInductionStep(const string &name, int bodyStart, int bodyEnd) {
+        if (RangeAnalysis::getInstance().countAssignments(name, bodyStart, bodyEnd) != 1) return NULL;
+        //the body is a statement in the loop's scope or a block in it, the step must not be nested deeper
+        int loopDepth = symbolTable.size() + 1;
+        for (int i = 0; i < inductionSteps.size(); i++) {
+            InductionStep &inductionStep = inductionSteps[i];
+            if (inductionStep.name == name && bodyStart <= inductionStep.address && inductionStep.address < bodyEnd
+                && inductionStep.depth <= loopDepth + 1) {
+                return &inductionStep;
+            }
+        }
+        return NULL;
+    }
+
+    string countedLoopGuard(Expression *exp, int bodyStart, int bodyEnd) {
+        BinaryExpression *condition = dynamic_cast<BinaryExpression *>(exp);
+        if (condition == NULL || !isInstanceOf<Relop>(condition->op)) return "";
+        Id *counter = dynamic_cast<Id *>(condition->leftExp);
+        if (counter == NULL || counter->homeRegister == "") return "";
+        InductionStep *inductionStep = findInductionStep(counter->name, bodyStart, bodyEnd);
+        if (inductionStep == NULL) return "";
+        int step = inductionStep->step;
+        string relop = ((Relop *) condition->op)->op;
+        bool isCountingUp = step > 0 && (relop == "<" || relop == "<=");
+        bool isCountingDown = step < 0 && (relop == ">" || relop == ">=");
+        if (!isCountingUp && !isCountingDown) return "";
+        /* the counter passes the test of the last unrolled iteration if it passes the test against the bound
+         * moved back by the steps of the other iterations, as long as the moved bound does not overflow */
+        long long distance = (long long) (unrollFactor - 1) * step;
+        Id *boundVariable = dynamic_cast<Id *>(condition->rightExp);
+        ValueRange bound = boundVariable != NULL ? condition->rightExp->Expression::valueRange()
+                                                  : condition->rightExp->valueRange();
+        if (bound.low - distance < INT_MIN_VALUE || bound.high - distance > INT_MAX_VALUE) return "";
+        //no temporary register holds a value between statements
+        string reg = Registers::getInstance().regAlloc();
+        Registers::getInstance().regFree(reg);
+        string guard;
+        if (boundVariable == NULL && bound.low == bound.high && bound.reasons.empty()) {
+            guard = "li " + reg + ", " + AssemblerCoder::to_string(bound.low - distance);
+        } else if (boundVariable != NULL && boundVariable->homeRegister != "" &&
+                   RangeAnalysis::getInstance().countAssignments(boundVariable->name, bodyStart, bodyEnd) == 0) {
+            guard = "addu " + reg + ", " + boundVariable->homeRegister + ", " + AssemblerCoder::to_string(-distance);
+        } else {
+            return "";
+        }
+        map<string, string> branches;
+        branches["<"] = "blt";
+        branches["<="] = "ble";
+        branches[">"] = "bgt";
+        branches[">="] = "bge";
+        return guard + "\n" + branches[relop] + " " + counter->homeRegister + ", " + reg + ", ";
+    }
+
+    void unrollLoop(Expression *exp, Statement *statement, int conditionStart, int bodyStart, int bodyEnd) {
+        if (unrollFactor < 2 || !statement->breakList.empty() || !statement->continueList.empty()) return;
+        if (!canCopyCode(bodyStart, bodyEnd, UNROLL_MAX_COMMANDS)) return;
+        string guard = countedLoopGuard(exp, bodyStart, bodyEnd);
+        if (guard == "") return;
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        //while the guard holds, [unrollFactor] iterations run without testing the condition in between
+        string unrolledLabel = codeBuffer.genLabel();
+        for (int i = 0; i < unrollFactor; i++) {
+            copyCode(bodyStart, bodyEnd);
+        }
+        codeBuffer.emit(guard + unrolledLabel);
+        //the remaining iterations run in the original loop
+        AssemblerCoder::getInstance().j("label_" + AssemblerCoder::to_string(conditionStart));
+        LoopInvariants::addToPreheader(conditionStart - 1, guard + unrolledLabel);
+    }
+
+    void reduceInductionMultiplications(int conditionStart, int bodyStart, int bodyEnd) {
+        int preheaderAddress = conditionStart - 1;
+        //the reduced values are kept in temporaries, that calls do not keep
+        for (int address = preheaderAddress; address < bodyEnd; address++) {
+            if (CodeBuffer::instance().getCommand(address).find("jal ") != string::npos) return;
+        }
+        for (int i = 0; i < inductionSteps.size(); i++) {
+            InductionStep *inductionStep = findInductionStep(inductionSteps[i].name, bodyStart, bodyEnd);
+            if (inductionStep != &inductionSteps[i]) continue;
+            LoopInvariants::getInstance().reduceMultiplications(inductionStep->name, inductionStep->step,
+                                                                inductionStep->address, preheaderAddress);
+        }
     }
 
     Statement * handleWhile(M *beforeConditionMarker, Expression *exp, M *beforeStatementMarker, Statement *statement,
                             M *endWhileMarker) {
         foldScope();
-        AssemblerCoder::getInstance().j(beforeConditionMarker->label);
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int conditionStart = labelAddress(beforeConditionMarker);
+        int bodyStart = labelAddress(beforeStatementMarker);
+        int bodyEnd = codeBuffer.nextAddress();
+        vector<int> trueList = exp->trueList;
+        vector<int> falseList = exp->falseList;
+        reduceInductionMultiplications(conditionStart, bodyStart, bodyEnd);
+        if (canCopyCode(conditionStart, bodyStart, ROTATE_MAX_COMMANDS)) {
+            //the loop is tested at its bottom, the condition at its top only guards the entry
+            int offset = copyCode(conditionStart, bodyStart);
+            for (int i = 0; i < exp->trueList.size(); i++) trueList.push_back(exp->trueList[i] + offset);
+            for (int i = 0; i < exp->falseList.size(); i++) falseList.push_back(exp->falseList[i] + offset);
+        } else {
+            AssemblerCoder::getInstance().j(beforeConditionMarker->label);
+        }
+        unrollLoop(exp, statement, conditionStart, bodyStart, bodyEnd);
+        LoopInvariants::getInstance().endLoop();
+        RangeAnalysis::getInstance().addLoop(conditionStart, codeBuffer.nextAddress());
         string endLable = CodeBuffer::instance().genLabel();
-        CodeBuffer::instance().bpatch(exp->trueList,beforeStatementMarker->label);
-        CodeBuffer::instance().bpatch(exp->falseList,endLable);
+        CodeBuffer::instance().bpatch(trueList,beforeStatementMarker->label);
+        CodeBuffer::instance().bpatch(falseList,endLable);
         CodeBuffer::instance().bpatch(statement->breakList,endLable);
         CodeBuffer::instance().bpatch(statement->continueList,endWhileMarker->label);
         delete statement;
@@ -398,80 +947,53 @@ namespace FanC {
     }
 
     string getRegister(Expression *exp) {
-        if(exp->registerName!=""){
-            return exp->registerName;
-        }
-        Id* id = extractIdFromSymbolTable((Id*)exp);
-        string regName = Registers::getInstance().regAlloc();
-        /* the loading from frame pointer will work only if there will
-         * since there are no global variables */
-        AssemblerCoder::getInstance().lw(regName,id->offset*-4);
-        return regName;
+        return exp->evaluate();
     }
 
     void divZeroBody(){
-        string errorDivZeroLabel="error_div_zero";
-        AssemblerCoder::getInstance().emitStringToData(errorDivZeroLabel+":","Error division by zero\\n");
+        string errorDivZeroLabel=AssemblerCoder::getInstance().internString("Error division by zero\\n");
+        functionLabels.push_back(DIV_BY_ZERO_LABEL);
 
         AssemblerCoder::getInstance().addLable(DIV_BY_ZERO_LABEL);
-        string regName = Registers::getInstance().regAlloc();
-        AssemblerCoder::getInstance().la(regName,errorDivZeroLabel);
-        /*prepering stack for function print*/
-        AssemblerCoder::getInstance().subu("$sp","$sp",WORD_SIZE*3); //make space for 3 reg alloc
-        AssemblerCoder::getInstance().sw("$fp",2*WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().sw("$ra",WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().sw(regName,0,"$sp");
-        AssemblerCoder::getInstance().subu("$fp","$sp",WORD_SIZE);
-        /*jumping to print function*/
-        Registers::getInstance().regFree(regName);
+        AssemblerCoder::getInstance().la(Registers::argumentRegister(0),errorDivZeroLabel);
         AssemblerCoder::getInstance().jal(PRINT_LABEL);
-        /*restore the reg from stack */
-        AssemblerCoder::getInstance().lw("$ra",WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().lw("$fp",2*WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().addu("$sp","$sp",WORD_SIZE*3);
         AssemblerCoder::getInstance().exitSyscall();
     }
 
     void printBody(){
+        functionLabels.push_back(PRINT_LABEL);
         AssemblerCoder::getInstance().addLable(PRINT_LABEL);
-        AssemblerCoder::getInstance().printSyscall(WORD_SIZE);
+        AssemblerCoder::getInstance().printSyscall();
         AssemblerCoder::getInstance().jr();
     }
 
     void printiBody(){
+        functionLabels.push_back(PRINTI_LABEL);
         AssemblerCoder::getInstance().addLable(PRINTI_LABEL);
-        AssemblerCoder::getInstance().printiSyscall(WORD_SIZE);
+        AssemblerCoder::getInstance().printiSyscall();
         AssemblerCoder::getInstance().jr();
     }
 
     void addPreConditionErrorBlock(Id* funcId) {
         
         AssemblerCoder& assembler= AssemblerCoder::getInstance();
-        assembler.j(AFTER_PRECOND_PREFIX_LABEL+funcId->name);
         assembler.addLable((string)PRECOND_ERR_LABEL_PREFIX+funcId->name);
-
-        string errorPrecondLabel="precond_data_error_"+funcId->name;
-        AssemblerCoder::getInstance().emitStringToData(errorPrecondLabel+":"
-                ,"Precondition hasn't been satisfied for function "+funcId->name+"\\n");
-
-
-        string regName = Registers::getInstance().regAlloc();
-        AssemblerCoder::getInstance().la(regName,errorPrecondLabel);
-        /*prepering stack for function print*/
-        AssemblerCoder::getInstance().subu("$sp","$sp",WORD_SIZE*3); //make space for 3 reg alloc
-        AssemblerCoder::getInstance().sw("$fp",2*WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().sw("$ra",WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().sw(regName,0,"$sp");
-        AssemblerCoder::getInstance().subu("$fp","$sp",WORD_SIZE);
-        /*jumping to print function*/
-        Registers::getInstance().regFree(regName);
-        AssemblerCoder::getInstance().jal(PRINT_LABEL);
-        /*restore the reg from stack */
-        AssemblerCoder::getInstance().lw("$ra",WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().lw("$fp",2*WORD_SIZE,"$sp");
-        AssemblerCoder::getInstance().addu("$sp","$sp",WORD_SIZE*3);
-        AssemblerCoder::getInstance().exitSyscall();
-        assembler.addLable(AFTER_PRECOND_PREFIX_LABEL+funcId->name);
+        assembler.la(Registers::argumentRegister(1),assembler.internString(funcId->name+"\\n"));
+        if (isPreConditionErrorEmitted) {
+            assembler.j(PRECOND_ERROR_LABEL);
+            return;
+        }
+        //the first function's error block goes on to the routine all of them share
+        isPreConditionErrorEmitted = true;
+        functionLabels.push_back(PRECOND_ERROR_LABEL);
+        assembler.addLable(PRECOND_ERROR_LABEL);
+        /*the program exits after the print, nothing has to be saved*/
+        assembler.la(Registers::argumentRegister(0),
+                     assembler.internString("Precondition hasn't been satisfied for function "));
+        assembler.printSyscall();
+        assembler.move(Registers::argumentRegister(0),Registers::argumentRegister(1));
+        CodeBuffer::instance().emit("syscall");
+        assembler.exitSyscall();
     }
 
     void initProgramHeader() {
@@ -492,25 +1014,81 @@ namespace FanC {
            assembler.move(call->registerName, "$v0");
         }else if(call->isBoolean()){
             int bne=assembler.bne("$v0","$0");
+            call->branchAddress=bne;
+            call->testedRegister="$v0";
             call->trueList=codeBuffer.makelist(bne);
             call->falseList=codeBuffer.makelist(assembler.j());
         }
     }
 
-    void handleRegisterInAssignmentDecl(Expression *exp) {
+    void handleRegisterInAssignmentDecl(Id *id, Expression *exp) {
+        learnAssignment(id, exp);
         changeBranchToVar(exp);//must be first
-        AssemblerCoder::getInstance().subu("$sp","$sp",WORD_SIZE);
-        AssemblerCoder::getInstance().sw(exp->registerName,0,"$sp");
-        Registers::getInstance().regFree(exp->registerName);
+        if (id->homeRegister != "") {
+            exp->evaluateTo(id->homeRegister);
+            return;
+        }
+        string regName = exp->evaluate();
+        AssemblerCoder::getInstance().sw(regName,id->offset*(-WORD_SIZE),"$fp");
+        Registers::getInstance().regFree(regName);
+    }
+
+    void initVariableInStack(Id *id) {
+        Number zero(0, new IntType());
+        learnAssignment(id, &zero);
+        if (id->homeRegister != "") {
+            zeroInitAddresses[id] = AssemblerCoder::getInstance().move(id->homeRegister,"$0");
+            return;
+        }
+        zeroInitAddresses[id] = AssemblerCoder::getInstance().sw("$0",id->offset*(-WORD_SIZE),"$fp");
     }
 
-    void initVariableInStack() {
-        AssemblerCoder::getInstance().subu("$sp","$sp",WORD_SIZE);
-        AssemblerCoder::getInstance().sw("$0",0,"$sp");//check if the change works sp to fp
+    void learnAssignment(Id *id, Expression *exp) {
+        RangeAnalysis::getInstance().addAssignment(id->name);
+        symbolTable.back()->killFacts(id->name);
+        if (!id->isNumric()) return;
+        ValueRange range = exp->valueRange();
+        ValueRange typeRange = id->valueRange();
+        if (!range.isWithin(typeRange.low, typeRange.high)) return;
+        symbolTable.back()->addFact(VariableFact(id->name, range));
+    }
+
+    void learnConditionFacts(Expression *exp) {
+        vector<VariableFact> facts;
+        exp->addTrueFacts(facts);
+        for (int i = 0; i < facts.size(); i++) {
+            facts[i].address = CodeBuffer::instance().nextAddress();
+            symbolTable.back()->addFact(facts[i]);
+        }
+    }
+
+    bool setOnCondition(Expression *exp) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        int need = exp->setOnConditionNeed();
+        if (need == -1) return false;
+        vector<int> branches;
+        exp->addBranchAddresses(branches);
+        string code;
+        for (int address = *min_element(branches.begin(), branches.end()); address < codeBuffer.nextAddress(); address++) {
+            code += codeBuffer.getCommand(address) + "\n";
+        }
+        //the values are held across the code of the expression, so its registers can't hold them
+        vector<string> free = Registers::getInstance().getFreeTempRegisters();
+        vector<string> pool;
+        for (int i = free.size() - 1; i >= 0; i--) {
+            if (code.find(free[i]) == string::npos) pool.push_back(free[i]);
+        }
+        if (pool.size() < need) return false;
+        exp->emitSetOnCondition(pool, exp->registerName);
+        Registers::getInstance().markAsUsed(exp->registerName);
+        exp->trueList.clear();
+        exp->falseList.clear();
+        return true;
     }
 
     void changeBranchToVar(Expression *exp) {
         if(!exp->isBoolean()) return;
+        if (setOnCondition(exp)) return;
         AssemblerCoder& assembler=AssemblerCoder::getInstance();
         assembler.comment("changing branch to var");
         string reg=Registers::getInstance().regAlloc();
@@ -531,26 +1109,24 @@ namespace FanC {
     void jumpToCaller() {
         AssemblerCoder& assembler=AssemblerCoder::getInstance();
         assembler.comment("return from function");
-        assembler.addu("$sp","$fp",WORD_SIZE);
+        if (getFunction()->id->name == "main") {
+            assembler.exit();
+            return;
+        }
+        epilogueAddresses.push_back(CodeBuffer::instance().emit(""));
         assembler.jr();
     }
 
     void updateReturnReg(Expression *exp) {
         changeBranchToVar(exp); //must be first in case of boolean exp is returned
         AssemblerCoder& assembler=AssemblerCoder::getInstance();
-        assembler.move("$v0",exp->registerName);
-        Registers::getInstance().regFree(exp->registerName);
+        string regName = exp->evaluate();
+        assembler.move("$v0",regName);
+        Registers::getInstance().regFree(regName);
     }
 
     Statement* jumpFromBreak() {
         Statement *statement=new Statement();
-        //folding stack
-        int numVarsBefore=offsets.back();
-        offsets.pop_back();
-        int numVars= numVarsBefore-offsets.back();
-        offsets.push_back(numVarsBefore); //restoring the offset
-        AssemblerCoder::getInstance().comment("return sp to the start of this scope");
-        AssemblerCoder::getInstance().addu("$sp","$sp",WORD_SIZE*numVars);
         //jump to be patched
         AssemblerCoder::getInstance().comment("jump on break");
         int jumpAdd=AssemblerCoder::getInstance().j();
@@ -572,15 +1148,276 @@ namespace FanC {
         dest->breakList = CodeBuffer::instance().merge(dest->breakList,src->breakList);
     }
 
+    void setUnrollFactor(int factor) {
+        unrollFactor = factor;
+    }
+
+    void setConstantPropagation(bool isEnabled) {
+        isConstantPropagation = isEnabled;
+    }
+
+    void setValueNumbering(bool isEnabled) {
+        isValueNumbering = isEnabled;
+    }
+
+    void setDeadCodeElimination(bool isEnabled) {
+        isDeadCodeElimination = isEnabled;
+    }
+
+    void setInstrumenting() {
+        Profile::getInstance().setInstrumenting();
+        AssemblerCoder::getInstance().setExitRoutine(PROFILE_DUMP_LABEL);
+    }
+
+    bool useProfile(const string &path) {
+        if (Profile::getInstance().load(path)) return true;
+        cerr << "no profile in " << path << endl;
+        return false;
+    }
+
+    bool setTarget(const string &name) {
+        if (name != "mips" && name != "x86_64") return false;
+        isX86Target = name == "x86_64";
+        return true;
+    }
+
+    bool setEmitted(const string &format) {
+        if (format != "asm" && format != "bytecode" && format != "obj") return false;
+        emittedFormat = format;
+        return true;
+    }
+
+    //the MIPS program as it is printed
+    string programText() {
+        stringstream program;
+        streambuf *output = cout.rdbuf(program.rdbuf());
+        CodeBuffer::instance().printDataBuffer();
+        CodeBuffer::instance().printCodeBuffer();
+        cout.rdbuf(output);
+        return program.str();
+    }
+
+    int printProgram() {
+        if (emittedFormat == "bytecode") {
+            BytecodeWriter writer;
+            if (!writer.write(programText(), functionLabels, cout)) {
+                cerr << "the bytecode could not be written: " << writer.getError() << endl;
+                return 1;
+            }
+            return 0;
+        }
+        if (emittedFormat == "obj") {
+            MipsObjectWriter writer;
+            if (!writer.write(programText(), functionLabels, cout)) {
+                cerr << "the object could not be written: " << writer.getError() << endl;
+                return 1;
+            }
+            return 0;
+        }
+        if (!isX86Target) {
+            CodeBuffer::instance().printDataBuffer();
+            CodeBuffer::instance().printCodeBuffer();
+            return 0;
+        }
+        X86Backend backend;
+        if (!backend.translate(programText(), cout)) {
+            cerr << "the translation to x86-64 failed: " << backend.getError() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    int runProgram() {
+        Simulator simulator(functionLabels);
+        bool isRun = simulator.run(programText(), cout);
+        simulator.printReport(cerr);
+        if (!isRun) {
+            cerr << "the simulation stopped: " << simulator.getError() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    int executeBytecode() {
+        BytecodeInterpreter interpreter;
+        if (!interpreter.load(cin)) {
+            cerr << "the bytecode could not be read: " << interpreter.getError() << endl;
+            return 1;
+        }
+        if (!interpreter.run(cout)) {
+            cerr << "the bytecode stopped: " << interpreter.getError() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     void funDecInAssembly(Id* id){
         AssemblerCoder& assembler=AssemblerCoder::getInstance();
+        functionLabels.push_back(id->name);
+        functionStarts.push_back(make_pair(id->name, CodeBuffer::instance().nextAddress()));
         assembler.addLable(id->name);
-        if(id->name == "main"){
-            assembler.move("$fp","$sp");
-            assembler.addu("$sp","$sp",WORD_SIZE);
+        entryChecksAddress = CodeBuffer::instance().emit("");
+        prologueAddress = CodeBuffer::instance().emit("");
+        functionEntryLabel = CodeBuffer::instance().genLabel();
+        loadArgumentsToRegisters();
+        preConditionsAddress = CodeBuffer::instance().nextAddress();
+    }
+
+    void recordEntryChecks(FuncDec *funDec) {
+        if (funDec->arguments->decelerations.size() > ARGUMENT_REG_NUM) return;
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        map<string, string> substitutes;
+        for (int i = 0; i < argumentHomes.size(); i++) {
+            if (argumentHomes[i] != "") substitutes[argumentHomes[i]] = Registers::argumentRegister(i);
+        }
+        vector<string> checks;
+        for (int address = preConditionsAddress; address < codeBuffer.nextAddress(); address++) {
+            string command = codeBuffer.getCommand(address);
+            if (isInstruction(command)) {
+                //calls, even inlined ones, take the argument registers
+                string opcode = command.substr(0, command.find(' '));
+                if (command.find("$a") != string::npos) return;
+                if (!AssemblerCoder::isSideEffectFree(command) && opcode[0] != 'b' && opcode != "j") return;
+            }
+            checks.push_back(Registers::rename(command, substitutes));
         }
-        addPreConditionErrorBlock(id);
+        funDec->entryChecks = checks;
+        funDec->entryChecksAddress = preConditionsAddress;
+    }
 
+    string copyEntryChecks(FuncDec *funDec, const string &labelPrefix, const string &failLabel) {
+        string errorLabel = (string) PRECOND_ERR_LABEL_PREFIX + funDec->id->name;
+        string code;
+        for (int i = 0; i < funDec->entryChecks.size(); i++) {
+            string command = funDec->entryChecks[i];
+            if (command == "" || command[0] == '#') continue;
+            for (size_t label = command.find("label_"); label != string::npos;
+                 label = command.find("label_", label + labelPrefix.size())) {
+                command.replace(label, 6, labelPrefix);
+            }
+            if (command.size() > errorLabel.size() && command.compare(command.size() - errorLabel.size(),
+                                                                       errorLabel.size(), errorLabel) == 0) {
+                command = command.substr(0, command.size() - errorLabel.size()) + failLabel;
+            }
+            code += (code == "" ? "" : "\n") + command;
+        }
+        return code;
+    }
+
+    void moveEntryChecks(FuncDec *funDec) {
+        if (funDec->conditions->size() == 0) return;
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string entry = funDec->id->name + UNCHECKED_ENTRY_SUFFIX + ":";
+        if (!funDec->hasUncheckedEntry) {
+            //the checks stay in the body, the entry is the function itself
+            codeBuffer.replace(entryChecksAddress, entry);
+            return;
+        }
+        string errorLabel = (string) PRECOND_ERR_LABEL_PREFIX + funDec->id->name;
+        codeBuffer.replace(entryChecksAddress, copyEntryChecks(funDec, funDec->id->name + CHECK_LABEL_INFIX, errorLabel) +
+                                               "\n" + entry);
+        int end = funDec->entryChecksAddress + funDec->entryChecks.size();
+        for (int address = funDec->entryChecksAddress; address < end; address++) {
+            if (isInstruction(codeBuffer.getCommand(address))) codeBuffer.replace(address, "");
+        }
+    }
+
+    void addChecksToSelfTailCalls(FuncDec *funDec) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string errorLabel = (string) PRECOND_ERR_LABEL_PREFIX + funDec->id->name;
+        for (int i = 0; i < selfTailCallAddresses.size(); i++) {
+            int address = selfTailCallAddresses[i];
+            string labelPrefix = funDec->id->name + CHECK_LABEL_INFIX + AssemblerCoder::to_string(address) + "_";
+            codeBuffer.replace(address, copyEntryChecks(funDec, labelPrefix, errorLabel) + "\n" +
+                                        codeBuffer.getCommand(address));
+        }
+    }
+
+    void checkPreConditionsAtCall(FuncDec *func, Call *call) {
+        if (func->conditions == NULL || func->conditions->size() == 0 || func->entryChecks.empty()) return;
+        //the function that is compiled decides at its end if its checks are moved, calls to it may skip them anyway
+        bool isRecursive = func == getFunction();
+        if (!isRecursive && !func->hasUncheckedEntry) return;
+        string name = func->id->name;
+        map<string, ValueRange> arguments;
+        for (int i = 0; i < func->arguments->decelerations.size(); i++) {
+            Expression *exp = call->expressions->expressions[i];
+            ValueRange range = exp->valueRange();
+            if (exp->isBoolean()) {
+                vector<Reason> reasons;
+                int value = exp->decide(map<string, ValueRange>(), reasons);
+                range = value == -1 ? ValueRange(0, 1) : ValueRange(value, value);
+                range.reasons = reasons;
+            }
+            arguments.insert(make_pair(func->arguments->decelerations[i]->id->name, range));
+        }
+        //a division in the checks may stop the program even when they hold
+        bool isProven = true;
+        vector<Reason> reasons;
+        for (int i = 0; i < func->entryChecks.size(); i++) {
+            if (func->entryChecks[i].find("div ") == 0) isProven = false;
+        }
+        for (int i = 0; i < func->conditions->size(); i++) {
+            if (func->conditions->preconditions[i]->exp->decide(arguments, reasons) != 1) isProven = false;
+        }
+        string uncheckedEntry = name + UNCHECKED_ENTRY_SUFFIX;
+        RangeAnalysis::getInstance().addCheck(call->jalAddress, "precondition checks of " + name, isProven, reasons,
+                                              name, uncheckedEntry);
+        if (isProven || isRecursive) return;
+        hoistPreConditionChecks(func, call);
+    }
+
+    void hoistPreConditionChecks(FuncDec *func, Call *call) {
+        int size = 0;
+        for (int i = 0; i < func->entryChecks.size(); i++) {
+            if (isInstruction(func->entryChecks[i])) size++;
+        }
+        //testing the hoisted result costs a command
+        if (size < 2) return;
+        string loads;
+        vector<string> variables;
+        for (int i = 0; i < call->expressions->expressions.size(); i++) {
+            Expression *exp = call->expressions->expressions[i];
+            string reg = Registers::argumentRegister(i);
+            Boolean *boolean = dynamic_cast<Boolean *>(exp);
+            Number *number = dynamic_cast<Number *>(exp);
+            Id *variable = dynamic_cast<Id *>(exp);
+            if (boolean != NULL) {
+                loads += "li " + reg + ", " + (boolean->value ? "1" : "0") + "\n";
+            } else if (number != NULL) {
+                loads += "li " + reg + ", " + AssemblerCoder::to_string(number->value) + "\n";
+            } else if (variable != NULL) {
+                if (variable->homeRegister != "") {
+                    loads += "move " + reg + ", " + variable->homeRegister + "\n";
+                } else {
+                    loads += "lw " + reg + ", " + AssemblerCoder::to_string(variable->offset * (-WORD_SIZE)) + "($fp)\n";
+                }
+                variables.push_back(variable->name);
+            } else {
+                return;
+            }
+        }
+        string name = func->id->name;
+        string labelPrefix = name + CHECK_LABEL_INFIX + AssemblerCoder::to_string(call->jalAddress) + "_";
+        string failLabel = labelPrefix + "failed";
+        LoopInvariants::getInstance().hoistCheck(name + "\n" + loads, loads + copyEntryChecks(func, labelPrefix, failLabel),
+                                                 failLabel, variables, call->jalAddress, name,
+                                                 name + UNCHECKED_ENTRY_SUFFIX,
+                                                 (string) PRECOND_ERR_LABEL_PREFIX + name);
+    }
+
+    void loadArgumentsToRegisters() {
+        vector<Id *> &arguments = symbolTable.back()->variables;
+        for (int i = 0; i < arguments.size(); i++) {
+            Id *argument = arguments[i];
+            argumentHomes.push_back(argument->homeRegister);
+            if (argument->homeRegister == "") continue;
+            if (i < ARGUMENT_REG_NUM) {
+                AssemblerCoder::getInstance().move(argument->homeRegister,Registers::argumentRegister(i));
+            } else {
+                AssemblerCoder::getInstance().lw(argument->homeRegister,argument->offset*(-WORD_SIZE));
+            }
+        }
     }
 
     Statement *assembleIf(Expression *exp, M *trueMarker, Statement *statement) {
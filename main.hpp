@@ -3,12 +3,23 @@
 #include "parser.hpp"
 #include "output.hpp"
 #include <assert.h>     /* assert */
+#include <map>
 
 #define PRINT_LABEL "print"
 #define PRINTI_LABEL "printi"
 
-#define AFTER_PRECOND_PREFIX_LABEL "after_precond_"
 namespace FanC {
+    //an assignment of the form "name = name + step"
+    struct InductionStep {
+        string name;
+        int step;
+        int address;
+        int depth; //the number of scopes the assignment is in
+
+        InductionStep(string _name, int _step, int _address, int _depth)
+                : name(_name), step(_step), address(_address), depth(_depth) {}
+    };
+
     void reduceProgram();
     void reduceFuncDecl(FuncDec *funDec, Expression *tempExp, Statements *statements);
     FuncDec * reduceFuncDeclSignature(ReturnType* returnType, Id* id, FormalList* formals);
@@ -16,6 +27,93 @@ namespace FanC {
     void reduceStatement();
     Statement * handleWhile(M *beforeConditionMarker, Expression *exp, M *beforeStatementMarker, Statement *statement,
                             M *endWhileMarker);
+
+    /**
+     * leaves a place for the guard of the unrolled loop before the loop's condition, returns the condition's marker.
+     */
+    M *reduceLoopEntry();
+
+    int labelAddress(M *marker);
+
+    /**
+     * checks that the code in [start, end) has at most [maxCommands] instructions and nothing that is completed
+     * later by its address, so it can be copied.
+     */
+    bool canCopyCode(int start, int end, int maxCommands);
+
+    /**
+     * emits a copy of the code in [start, end), the labels located there are moved with it.
+     * returns the distance of the copy from the original.
+     */
+    int copyCode(int start, int end);
+
+    /**
+     * returns the induction step of the variable if the loop body in [bodyStart, bodyEnd) assigns it exactly once,
+     * by adding a literal to it in every iteration. returns NULL otherwise.
+     */
+    InductionStep *findInductionStep(const string &name, int bodyStart, int bodyEnd);
+
+    /**
+     * for a loop "while (i relop bound)" with an induction step of i and a bound the body does not assign,
+     * returns the branch (without its label) taken while [unrollFactor] more iterations would pass the test.
+     * returns "" for other loops.
+     */
+    string countedLoopGuard(Expression *exp, int bodyStart, int bodyEnd);
+
+    /**
+     * emits the body of a counted loop [unrollFactor] times after the loop, entered by a guard at the loop's
+     * entry and repeated while the guard holds. the original loop runs the remaining iterations.
+     */
+    void unrollLoop(Expression *exp, Statement *statement, int conditionStart, int bodyStart, int bodyEnd);
+
+    /**
+     * replaces the multiplications of the loop's induction variables by constants with registers that are
+     * advanced with the variables, when the loop calls no function.
+     */
+    void reduceInductionMultiplications(int conditionStart, int bodyStart, int bodyEnd);
+
+    void setUnrollFactor(int factor);
+    void setConstantPropagation(bool isEnabled);
+    void setValueNumbering(bool isEnabled);
+    void setDeadCodeElimination(bool isEnabled);
+
+    /**
+     * makes the compiled program count the runs of its blocks and calls, and print the counts when it exits.
+     */
+    void setInstrumenting();
+
+    /**
+     * optimizes by the counts an instrumented program printed to the file. returns false if it has none.
+     */
+    bool useProfile(const string &path);
+
+    /**
+     * selects the code the compiler prints, "mips" or "x86_64", that is translated from the MIPS code. returns
+     * false for any other target.
+     */
+    bool setTarget(const string &name);
+
+    /**
+     * selects the form the program is printed in, "asm" for the target's assembly, "bytecode" for the
+     * interpreter of --exec or "obj" for a MIPS32 ELF object. returns false for any other form.
+     */
+    bool setEmitted(const string &format);
+
+    /**
+     * prints the compiled program for the target. returns the exit code of the compiler.
+     */
+    int printProgram();
+
+    /**
+     * runs the compiled program in the built-in simulator instead of printing it, and prints the counts of what
+     * it ran to stderr. returns the exit code of the compiler.
+     */
+    int runProgram();
+
+    /**
+     * runs the bytecode read from stdin in the interpreter, printing its output. returns the exit code.
+     */
+    int executeBytecode();
     void reduceFormalDecl(Type* type,Id* id);
     void reduceOpenWhileScope(Expression *exp);
     void reduceOpenScope();
@@ -58,9 +156,25 @@ namespace FanC {
 
     void saveReturnValueInCallRegister(Call *call);
 
-    void handleRegisterInAssignmentDecl(Expression *exp);
+    void handleRegisterInAssignmentDecl(Id *id, Expression *exp);
+
+    void initVariableInStack(Id *id);
+
+    /**
+     * the variable holds the value of [exp] from here on, what was known about its old value is forgotten.
+     */
+    void learnAssignment(Id *id, Expression *exp);
+
+    /**
+     * the facts that hold where the condition is true are known in the scope that was just opened.
+     */
+    void learnConditionFacts(Expression *exp);
 
-    void initVariableInStack();
+    /**
+     * computes the value of a boolean expression that is consumed as data with set-on-condition instructions
+     * instead of its branches. returns false if the branches must stay, e.g the short-circuited rhs has calls.
+     */
+    bool setOnCondition(Expression *exp);
 
     void changeBranchToVar(Expression* exp);
 
@@ -82,6 +196,113 @@ namespace FanC {
 
     void funDecInAssembly(Id* id);
 
+    /**
+     * emits the block that the failed preconditions of the function jump to, after the function's code.
+     * it passes the function's name to the error routine all the functions share.
+     */
+    void addPreConditionErrorBlock(Id* funcId);
+
+    /**
+     * keeps the checks of the function's preconditions, reading the arguments in $a0-$a3 instead of their homes,
+     * when they only compute values - they can then run before the frame is set up.
+     */
+    void recordEntryChecks(FuncDec *funDec);
+
+    /**
+     * returns a copy of the function's checks with its own labels, that jumps to [failLabel] when they fail.
+     */
+    string copyEntryChecks(FuncDec *funDec, const string &labelPrefix, const string &failLabel);
+
+    /**
+     * moves the checks of a function that has a frame before its prologue, followed by its unchecked entry
+     * that the callers which prove the preconditions call.
+     */
+    void moveEntryChecks(FuncDec *funDec);
+
+    /**
+     * the recursions in a tail position jump after the moved checks, so the ones that did not prove
+     * the preconditions check them before jumping.
+     */
+    void addChecksToSelfTailCalls(FuncDec *funDec);
+
+    /**
+     * calls the unchecked entry of the function when the values of the arguments prove its preconditions,
+     * otherwise tries to hoist the checks out of the loop the call is in.
+     */
+    void checkPreConditionsAtCall(FuncDec *func, Call *call);
+
+    /**
+     * computes the checks of a call whose arguments are literals or variables in the preheader of its loop,
+     * the call tests their result and calls the unchecked entry.
+     */
+    void hoistPreConditionChecks(FuncDec *func, Call *call);
+
+    /**
+     * fills the function's prologue and the epilogue before every return, once it is known
+     * which stored registers it used, if it calls other functions and if it has a frame in the stack.
+     * returns true if the function runs without a frame.
+     */
+    bool fillFrame(Id *funcId);
+
+    /**
+     * compiles a returned call as a jump to the function after releasing the frame, returns false if the
+     * call has to return here first. a function that calls itself this way jumps back to its entry.
+     */
+    bool compileTailCall(Expression *exp);
+
+    /**
+     * releases the frame before every tail call.
+     */
+    void fillTailCalls(const string &epilogue);
+
+    /**
+     * keeps the code of a small function that runs without a frame, to be copied into its call sites.
+     */
+    void keepInlineBody(FuncDec *funDec);
+
+    /**
+     * moves the frame setup of a function that keeps its $sp fixed from its entry to its first call,
+     * so the paths that return before calling anything (and leaf functions) run without a frame.
+     * returns false when the code before the first call can not do without the frame.
+     */
+    bool shrinkWrapFrame(const string &prologue, const string &epilogue);
+
+    /**
+     * returns true if the line of the code that holds the position [found] is the copy "move <home>, <reg>".
+     */
+    bool isArgumentCopy(const string &code, size_t found, const string &home, const string &reg);
+
+    /**
+     * returns the address of the label a jump command targets, or -1 if it does not target a generated label.
+     */
+    int jumpTarget(const string &command);
+
+    /**
+     * checks that the function's code so far ends with a return that no label precedes, so its end is unreachable.
+     */
+    bool endsWithReturn();
+
+    /**
+     * checks that the command is an instruction - not empty, a comment or a label.
+     */
+    bool isInstruction(const string &command);
+
+    /**
+     * checks that the code right after [address] continues to the label at [target] without executing anything.
+     */
+    bool fallsThrough(int address, int target);
+
+    /**
+     * drops the jumps to the next instruction and inverts the branches over the jump to their false label,
+     * so the true target falls through, from [start] to the end of the function.
+     */
+    void layoutBranches(int start);
+
+    /**
+     * loads the arguments that are kept in registers from the stack, at the function's entry.
+     */
+    void loadArgumentsToRegisters();
+
     /**
      * the function assemble new statement with the continueList and breakList of the [statement]
      * and backpatch the trueList with trueMarker, and falseList with falseMarker
@@ -97,6 +318,12 @@ namespace FanC {
 
     void foldScope();
 
+    /**
+     * removes the zero initialization of a variable that is assigned before it is read - the assignment
+     * is in the variable's own scope, so it runs whenever the declaration does.
+     */
+    void removeZeroInit(Id *id);
+
     Statement* assembleStatements(Statements* statements);
 
 }
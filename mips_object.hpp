@@ -0,0 +1,474 @@
+#ifndef HW3_MIPS_OBJECT_HPP
+#define HW3_MIPS_OBJECT_HPP
+#define AT_REGISTER (1) //the assembler's temporary, the expansions of the pseudo-instructions compute in it
+#define EF_MIPS_FLAGS (0x50001001u) //MIPS32, the o32 ABI, noreorder - every delay slot is filled already
+#define R_MIPS_26 (4)
+#define R_MIPS_HI16 (5)
+#define R_MIPS_LO16 (6)
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "simulator.hpp"
+
+using namespace std;
+
+/**
+ * encodes the compiled program into MIPS32 machine code and writes it as a relocatable ELF32 object, little
+ * endian like SPIM, with the sections .text and .data, the relocations of .text and a symbol table with the
+ * functions - main is global, the others are local.
+ * the program is decoded by the simulator's assembler, and the pseudo-instructions are expanded the way an
+ * assembler does, through $at: li and la into lui and ori or addiu, the branches on a comparison into slt and
+ * beq or bne, move into addu, the immediates that do not fit 16 bits into a li to $at. every jump and branch
+ * gets a nop in its delay slot, so the code runs as it does in SPIM. a jump's target is not known while the
+ * code before it is encoded, so its word is left for a fixup, that is resolved when all the code is encoded.
+ * the syscalls keep SPIM's numbers, the object is linked with a runtime that serves them.
+ */
+class MipsObjectWriter {
+private:
+    typedef Simulator::Instruction Instruction;
+
+    enum Opcode {
+        SPECIAL = 0, J_OP = 2, JAL_OP = 3, BEQ_OP = 4, BNE_OP = 5, ADDIU_OP = 9, SLTI_OP = 10, SLTIU_OP = 11,
+        ANDI_OP = 12, ORI_OP = 13, XORI_OP = 14, LUI_OP = 15, SPECIAL2 = 28, LW_OP = 35, SW_OP = 43
+    };
+
+    enum Function {
+        SLL_FN = 0, SRL_FN = 2, SRA_FN = 3, SLLV_FN = 4, SRLV_FN = 6, SRAV_FN = 7, JR_FN = 8, SYSCALL_FN = 12,
+        MFHI_FN = 16, MFLO_FN = 18, MULT_FN = 24, DIV_FN = 26, ADDU_FN = 33, SUBU_FN = 35, AND_FN = 36, OR_FN = 37,
+        XOR_FN = 38, NOR_FN = 39, SLT_FN = 42, SLTU_FN = 43, MUL_FN = 2 //mul is of SPECIAL2
+    };
+
+    //the symbols of the sections, the relocations are relative to them
+    enum Symbol {
+        TEXT_SYMBOL = 1, DATA_SYMBOL = 2
+    };
+
+    enum FixupKind {
+        BRANCH_FIXUP, JUMP_FIXUP, ADDRESS_FIXUP
+    };
+
+    //a word of the code that needs the address of an instruction
+    struct Fixup {
+        int word;
+        int target;
+        FixupKind kind;
+
+        Fixup(int _word, int _target, FixupKind _kind) : word(_word), target(_target), kind(_kind) {}
+    };
+
+    struct Relocation {
+        unsigned int offset;
+        int symbol;
+        int type;
+
+        Relocation(unsigned int _offset, int _symbol, int _type) : offset(_offset), symbol(_symbol), type(_type) {}
+    };
+
+    vector<unsigned int> text;
+    vector<int> addresses; //the offset in .text of every instruction of the program, and of its end
+    vector<Fixup> fixups;
+    vector<Relocation> relocations;
+    string error;
+
+    bool fail(const Instruction &instruction, const string &message) {
+        if (error == "") error = "line " + toString(instruction.line) + ": " + message;
+        return false;
+    }
+
+    static string toString(long long num) {
+        stringstream ss;
+        ss << num;
+        return ss.str();
+    }
+
+    static bool isSigned16(int value) {
+        return value >= -32768 && value <= 32767;
+    }
+
+    static bool isUnsigned16(int value) {
+        return value >= 0 && value <= 0xffff;
+    }
+
+    static unsigned int rType(int rs, int rt, int rd, int shift, Function function) {
+        return (rs << 21) | (rt << 16) | (rd << 11) | ((shift & 31) << 6) | function;
+    }
+
+    static unsigned int iType(Opcode opcode, int rs, int rt, int immediate) {
+        return ((unsigned int) opcode << 26) | (rs << 21) | (rt << 16) | (immediate & 0xffff);
+    }
+
+    void emit(unsigned int word) {
+        text.push_back(word);
+    }
+
+    void loadImmediate(int reg, int value) {
+        if (isSigned16(value)) {
+            emit(iType(ADDIU_OP, 0, reg, value));
+        } else if (isUnsigned16(value)) {
+            emit(iType(ORI_OP, 0, reg, value));
+        } else {
+            emit(iType(LUI_OP, 0, reg, (unsigned int) value >> 16));
+            if ((value & 0xffff) != 0) emit(iType(ORI_OP, reg, reg, value));
+        }
+    }
+
+    //lui and addiu of an offset in a section, the linker adds the section's address
+    void loadAddress(int reg, unsigned int offset, int symbol) {
+        relocations.push_back(Relocation(4 * text.size(), symbol, R_MIPS_HI16));
+        emit(iType(LUI_OP, 0, reg, (offset + 0x8000) >> 16));
+        relocations.push_back(Relocation(4 * text.size(), symbol, R_MIPS_LO16));
+        emit(iType(ADDIU_OP, reg, reg, offset));
+    }
+
+    //the register of the second source, an immediate is loaded to $at first
+    int secondRegister(const Instruction &instruction) {
+        if (instruction.second != -1) return instruction.second;
+        if (instruction.immediate == 0) return 0;
+        loadImmediate(AT_REGISTER, instruction.immediate);
+        return AT_REGISTER;
+    }
+
+    void emitBranch(Opcode opcode, int rs, int rt, int target) {
+        fixups.push_back(Fixup(text.size(), target, BRANCH_FIXUP));
+        emit(iType(opcode, rs, rt, 0));
+        emit(0); //the delay slot
+    }
+
+    void emitArithmetic(const Instruction &instruction, Function function) {
+        int second = secondRegister(instruction);
+        emit(rType(instruction.source, second, instruction.destination, 0, function));
+    }
+
+    //an operation that has an immediate form, used when the immediate fits it
+    void emitImmediateForm(const Instruction &instruction, Opcode opcode, bool isFitting, Function function) {
+        if (instruction.second == -1 && isFitting) {
+            emit(iType(opcode, instruction.source, instruction.destination, instruction.immediate));
+        } else {
+            emitArithmetic(instruction, function);
+        }
+    }
+
+    void emitShift(const Instruction &instruction, Function function, Function variable) {
+        if (instruction.second == -1) {
+            emit(rType(0, instruction.source, instruction.destination, instruction.immediate, function));
+        } else {
+            emit(rType(instruction.second, instruction.source, instruction.destination, 0, variable));
+        }
+    }
+
+    /**
+     * blt, bge, bgt and ble set $at to the comparison with slt, and branch on it with bne or beq.
+     */
+    void emitComparisonBranch(const Instruction &instruction) {
+        bool isLess = instruction.operation == Simulator::BLT || instruction.operation == Simulator::BGE;
+        Opcode opcode = instruction.operation == Simulator::BLT || instruction.operation == Simulator::BGT
+                        ? BNE_OP : BEQ_OP;
+        if (isLess && instruction.second == -1 && isSigned16(instruction.immediate)) {
+            emit(iType(SLTI_OP, instruction.source, AT_REGISTER, instruction.immediate));
+        } else {
+            int second = secondRegister(instruction);
+            if (isLess) {
+                emit(rType(instruction.source, second, AT_REGISTER, 0, SLT_FN));
+            } else {
+                emit(rType(second, instruction.source, AT_REGISTER, 0, SLT_FN));
+            }
+        }
+        emitBranch(opcode, AT_REGISTER, 0, instruction.target);
+    }
+
+    bool encode(const Instruction &instruction) {
+        int d = instruction.destination, s = instruction.source;
+        switch (instruction.operation) {
+            case Simulator::LI:
+                loadImmediate(d, instruction.immediate);
+                break;
+            case Simulator::LA:
+                if (instruction.target == -1) {
+                    loadAddress(d, instruction.immediate - DATA_BASE, DATA_SYMBOL);
+                } else {
+                    fixups.push_back(Fixup(text.size(), instruction.target, ADDRESS_FIXUP));
+                    loadAddress(d, 0, TEXT_SYMBOL);
+                }
+                break;
+            case Simulator::MOVE:
+                emit(rType(s, 0, d, 0, ADDU_FN));
+                break;
+            case Simulator::ADDU:
+                emitImmediateForm(instruction, ADDIU_OP, isSigned16(instruction.immediate), ADDU_FN);
+                break;
+            case Simulator::SUBU:
+                if (instruction.second == -1 && isSigned16(instruction.immediate) && instruction.immediate != -32768) {
+                    emit(iType(ADDIU_OP, s, d, -instruction.immediate));
+                } else {
+                    emitArithmetic(instruction, SUBU_FN);
+                }
+                break;
+            case Simulator::MUL: {
+                int second = secondRegister(instruction);
+                emit(((unsigned int) SPECIAL2 << 26) | rType(s, second, d, 0, MUL_FN));
+                break;
+            }
+            case Simulator::DIV: {
+                int second = secondRegister(instruction);
+                emit(rType(s, second, 0, 0, DIV_FN));
+                emit(rType(0, 0, d, 0, MFLO_FN));
+                break;
+            }
+            case Simulator::MULT: {
+                int second = secondRegister(instruction);
+                emit(rType(s, second, 0, 0, MULT_FN));
+                break;
+            }
+            case Simulator::MFHI:
+                emit(rType(0, 0, d, 0, MFHI_FN));
+                break;
+            case Simulator::MFLO:
+                emit(rType(0, 0, d, 0, MFLO_FN));
+                break;
+            case Simulator::AND:
+                emitImmediateForm(instruction, ANDI_OP, isUnsigned16(instruction.immediate), AND_FN);
+                break;
+            case Simulator::OR:
+                emitImmediateForm(instruction, ORI_OP, isUnsigned16(instruction.immediate), OR_FN);
+                break;
+            case Simulator::XOR:
+                emitImmediateForm(instruction, XORI_OP, isUnsigned16(instruction.immediate), XOR_FN);
+                break;
+            case Simulator::NOR:
+                emitArithmetic(instruction, NOR_FN);
+                break;
+            case Simulator::SLT:
+                emitImmediateForm(instruction, SLTI_OP, isSigned16(instruction.immediate), SLT_FN);
+                break;
+            case Simulator::SLTU:
+                emitImmediateForm(instruction, SLTIU_OP, isSigned16(instruction.immediate), SLTU_FN);
+                break;
+            case Simulator::SLL:
+                emitShift(instruction, SLL_FN, SLLV_FN);
+                break;
+            case Simulator::SRL:
+                emitShift(instruction, SRL_FN, SRLV_FN);
+                break;
+            case Simulator::SRA:
+                emitShift(instruction, SRA_FN, SRAV_FN);
+                break;
+            case Simulator::LW:
+            case Simulator::SW:
+                if (!isSigned16(instruction.immediate)) return fail(instruction, "the offset does not fit 16 bits");
+                emit(iType(instruction.operation == Simulator::LW ? LW_OP : SW_OP, s, d, instruction.immediate));
+                break;
+            case Simulator::BEQ:
+            case Simulator::BNE: {
+                int second = secondRegister(instruction);
+                emitBranch(instruction.operation == Simulator::BEQ ? BEQ_OP : BNE_OP, s, second, instruction.target);
+                break;
+            }
+            case Simulator::BLT:
+            case Simulator::BLE:
+            case Simulator::BGT:
+            case Simulator::BGE:
+                emitComparisonBranch(instruction);
+                break;
+            case Simulator::J:
+            case Simulator::JAL:
+                fixups.push_back(Fixup(text.size(), instruction.target, JUMP_FIXUP));
+                relocations.push_back(Relocation(4 * text.size(), TEXT_SYMBOL, R_MIPS_26));
+                emit((unsigned int) (instruction.operation == Simulator::J ? J_OP : JAL_OP) << 26);
+                emit(0);
+                break;
+            case Simulator::JR:
+                emit(rType(s, 0, 0, 0, JR_FN));
+                emit(0);
+                break;
+            case Simulator::SYSCALL:
+                emit(rType(0, 0, 0, 0, SYSCALL_FN));
+                break;
+            case Simulator::NOP:
+                emit(0);
+                break;
+        }
+        return true;
+    }
+
+    //puts the addresses of the instructions in the words that were left for them
+    bool resolveFixups(const vector<Instruction> &code) {
+        for (int i = 0; i < fixups.size(); i++) {
+            const Fixup &fixup = fixups[i];
+            unsigned int address = addresses[fixup.target];
+            if (fixup.kind == BRANCH_FIXUP) {
+                int offset = ((int) address - 4 * (fixup.word + 1)) / 4;
+                if (!isSigned16(offset)) return fail(code[owner(fixup.word)], "the branch is too far");
+                text[fixup.word] |= offset & 0xffff;
+            } else if (fixup.kind == JUMP_FIXUP) {
+                text[fixup.word] |= (address >> 2) & 0x3ffffff;
+            } else {
+                text[fixup.word] |= ((address + 0x8000) >> 16) & 0xffff;
+                text[fixup.word + 1] |= address & 0xffff;
+            }
+        }
+        return true;
+    }
+
+    //the instruction a word of the code was encoded from
+    int owner(int word) const {
+        return upper_bound(addresses.begin(), addresses.end(), 4 * word) - addresses.begin() - 1;
+    }
+
+    static void putHalf(string &bytes, unsigned int half) {
+        bytes += (char) (half & 0xff);
+        bytes += (char) ((half >> 8) & 0xff);
+    }
+
+    static void putWord(string &bytes, unsigned int word) {
+        putHalf(bytes, word & 0xffff);
+        putHalf(bytes, word >> 16);
+    }
+
+    static void align(string &bytes) {
+        while (bytes.size() % 4 != 0) bytes += '\0';
+    }
+
+    //the offset of the name in a string table, that is added to it
+    static unsigned int addName(string &table, const string &name) {
+        unsigned int offset = table.size();
+        table += name;
+        table += '\0';
+        return offset;
+    }
+
+    static void putSymbol(string &symbols, unsigned int name, unsigned int value, unsigned int size, int binding,
+                          int type, int section) {
+        putWord(symbols, name);
+        putWord(symbols, value);
+        putWord(symbols, size);
+        symbols += (char) ((binding << 4) | type);
+        symbols += '\0';
+        putHalf(symbols, section);
+    }
+
+    static void putSection(string &headers, unsigned int name, unsigned int type, unsigned int flags,
+                           unsigned int offset, unsigned int size, unsigned int link, unsigned int info,
+                           unsigned int alignment, unsigned int entrySize) {
+        putWord(headers, name);
+        putWord(headers, type);
+        putWord(headers, flags);
+        putWord(headers, 0);
+        putWord(headers, offset);
+        putWord(headers, size);
+        putWord(headers, link);
+        putWord(headers, info);
+        putWord(headers, alignment);
+        putWord(headers, entrySize);
+    }
+
+    /**
+     * the symbols of the sections and the functions, the local ones first as ELF wants. returns the index of
+     * the first global one.
+     */
+    int buildSymbols(const Simulator &assembler, const vector<string> &functions, string &symbols,
+                     string &names) {
+        putSymbol(symbols, 0, 0, 0, 0, 0, 0);
+        putSymbol(symbols, 0, 0, 0, 0, 3, 1); //STT_SECTION of .text
+        putSymbol(symbols, 0, 0, 0, 0, 3, 2); //STT_SECTION of .data
+        vector<int> starts;
+        for (int i = 0; i < functions.size(); i++) {
+            int index = assembler.labelIndex(functions[i]);
+            if (index != -1) starts.push_back(addresses[index]);
+        }
+        starts.push_back(4 * text.size());
+        sort(starts.begin(), starts.end());
+        int firstGlobal = 3;
+        for (int binding = 0; binding <= 1; binding++) {
+            if (binding == 1) firstGlobal = symbols.size() / 16;
+            for (int i = 0; i < functions.size(); i++) {
+                if (assembler.labelIndex(functions[i]) == -1 || (functions[i] == "main") != (binding == 1)) continue;
+                unsigned int start = addresses[assembler.labelIndex(functions[i])];
+                unsigned int end = *upper_bound(starts.begin(), starts.end(), start);
+                putSymbol(symbols, addName(names, functions[i]), start, end - start, binding, 2, 1); //STT_FUNC
+            }
+        }
+        return firstGlobal;
+    }
+
+public:
+    MipsObjectWriter() : text(), addresses(), fixups(), relocations(), error() {}
+
+    /**
+     * writes the MIPS program as an ELF object to [out]. [functions] are the labels the functions start at.
+     * returns false, with the error in getError(), if it could not be assembled or encoded.
+     */
+    bool write(const string &program, const vector<string> &functions, ostream &out) {
+        Simulator assembler(functions);
+        if (!assembler.assemble(program)) {
+            error = assembler.getError();
+            return false;
+        }
+        const vector<Instruction> &code = assembler.getCode();
+        for (int i = 0; i < code.size(); i++) {
+            addresses.push_back(4 * text.size());
+            if (!encode(code[i])) return false;
+        }
+        addresses.push_back(4 * text.size());
+        if (!resolveFixups(code)) return false;
+        const vector<unsigned char> &data = assembler.getData();
+
+        string sectionNames(1, '\0'), names(1, '\0'), symbols, rel, headers;
+        int firstGlobal = buildSymbols(assembler, functions, symbols, names);
+        for (int i = 0; i < relocations.size(); i++) {
+            putWord(rel, relocations[i].offset);
+            putWord(rel, (relocations[i].symbol << 8) | relocations[i].type);
+        }
+        unsigned int textName = addName(sectionNames, ".text"), dataName = addName(sectionNames, ".data");
+        unsigned int relName = addName(sectionNames, ".rel.text"), symbolsName = addName(sectionNames, ".symtab");
+        unsigned int namesName = addName(sectionNames, ".strtab");
+        unsigned int sectionNamesName = addName(sectionNames, ".shstrtab");
+        string file;
+        file.append("\177ELF\1\1\1", 7); //32 bits, little endian, version 1
+        file.append(9, '\0');
+        putHalf(file, 1); //ET_REL
+        putHalf(file, 8); //EM_MIPS
+        putWord(file, 1);
+        putWord(file, 0);
+        putWord(file, 0);
+        size_t headersOffset = file.size();
+        putWord(file, 0); //the offset of the section headers, when it is known
+        putWord(file, EF_MIPS_FLAGS);
+        putHalf(file, 52);
+        putHalf(file, 0);
+        putHalf(file, 0);
+        putHalf(file, 40);
+        putHalf(file, 7);
+        putHalf(file, 6); //.shstrtab
+
+        //SHT_PROGBITS 1, SHT_SYMTAB 2, SHT_STRTAB 3, SHT_REL 9
+        putSection(headers, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        putSection(headers, textName, 1, 6, file.size(), 4 * text.size(), 0, 0, 4, 0); //SHF_ALLOC | SHF_EXECINSTR
+        for (int i = 0; i < text.size(); i++) putWord(file, text[i]);
+        putSection(headers, dataName, 1, 3, file.size(), data.size(), 0, 0, 4, 0); //SHF_WRITE | SHF_ALLOC
+        file.append(data.begin(), data.end());
+        align(file);
+        putSection(headers, relName, 9, 0, file.size(), rel.size(), 4, 1, 4, 8);
+        file += rel;
+        putSection(headers, symbolsName, 2, 0, file.size(), symbols.size(), 5, firstGlobal, 4, 16);
+        file += symbols;
+        putSection(headers, namesName, 3, 0, file.size(), names.size(), 0, 0, 1, 0);
+        file += names;
+        putSection(headers, sectionNamesName, 3, 0, file.size(), sectionNames.size(), 0, 0, 1, 0);
+        file += sectionNames;
+        align(file);
+        string headersStart;
+        putWord(headersStart, file.size());
+        file.replace(headersOffset, 4, headersStart);
+        file += headers;
+        out.write(file.data(), file.size());
+        out.flush();
+        return true;
+    }
+
+    string getError() const {
+        return error;
+    }
+};
+
+#endif //HW3_MIPS_OBJECT_HPP
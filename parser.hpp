@@ -6,13 +6,25 @@
 #include <vector>
 #include <typeinfo>
 #include <sstream>
+#include <map>
 #include <stdbool.h>
 #include <stdlib.h>     /* atoi */
 #include "output.hpp"
 #include "registers.hpp"
 #include "bp.hpp"
 #include "assembler_coder.hpp"
+#include "range_analysis.hpp"
+#include "loop_invariants.hpp"
+#include "constant_propagation.hpp"
+#include "value_numbering.hpp"
+#include "dead_code.hpp"
+#include "simulator.hpp"
+#include "profile.hpp"
+#include "x86_backend.hpp"
+#include "bytecode.hpp"
+#include "mips_object.hpp"
 #include <assert.h>     /* assert */
+#include <algorithm>
 
 using namespace std;
 using namespace output;
@@ -221,11 +233,128 @@ namespace FanC {
         vector<int> trueList;
         vector<int> falseList;
         string registerName;
+        int branchAddress; //the branch that tests the value of a boolean leaf, followed by a jump to the false label
+        string testedRegister; //the register that the branch tests, for values that are already computed
 
-        explicit Expression(ReturnType *_type) : type(_type), trueList(), falseList(), registerName("") {}
+        explicit Expression(ReturnType *_type) : type(_type), trueList(), falseList(), registerName(""),
+                                                 branchAddress(-1), testedRegister("") {}
 
         virtual Id *isPreconditionable(){}
 
+        /**
+         * Sethi-Ullman label - the number of registers needed to evaluate this expression.
+         * expressions that already hold their value in a register need only that register.
+         */
+        virtual int registerNeed() {
+            return 1;
+        }
+
+        /**
+         * numeric and string expressions are side effect free (calls are emitted when they are reduced),
+         * so their code is deferred until the value is consumed. a division by what may be zero is the exception,
+         * it is emitted where it is reduced.
+         * the method emits the deferred code and returns the register that holds the value.
+         */
+        virtual string evaluate() {
+            return registerName;
+        }
+
+        /**
+         * the values a numeric expression may have.
+         */
+        virtual ValueRange valueRange() {
+            if (isInstanceOf<ByteType>(type)) return ValueRange(0, BYTE_MAX_VALUE);
+            return ValueRange(INT_MIN_VALUE, INT_MAX_VALUE);
+        }
+
+        /**
+         * the values of a numeric expression when the variables in [arguments] have the given values,
+         * the other variables have what is known about them where they are read.
+         */
+        virtual ValueRange rangeWith(const map<string, ValueRange> &arguments) {
+            return valueRange();
+        }
+
+        /**
+         * decides a boolean expression when the variables in [arguments] have the given values (see rangeWith).
+         * returns 1 if it is true, 0 if it is false and -1 if the values do not decide it,
+         * and adds the facts the decision relies on to [reasons].
+         */
+        virtual int decide(const map<string, ValueRange> &arguments, vector<Reason> &reasons) {
+            return -1;
+        }
+
+        /**
+         * adds the facts about variables that hold when a boolean expression is true.
+         */
+        virtual void addTrueFacts(vector<VariableFact> &facts) {}
+
+        /**
+         * the name of the variable the expression reads, or "".
+         */
+        virtual string variableName() {
+            return "";
+        }
+
+        /**
+         * returns true and sets [value] if the expression is a literal that was not loaded to a register yet.
+         */
+        virtual bool isLiteral(int &value) {
+            return false;
+        }
+
+        /**
+         * returns true and sets [step] if the expression is the variable [name] plus or minus a literal.
+         */
+        virtual bool isIncrementOf(const string &name, int &step) {
+            return false;
+        }
+
+        /**
+         * the number of registers that hold values while the branches of a boolean expression are rewritten
+         * to set-on-condition instructions, or -1 if they can't be.
+         */
+        virtual int setOnConditionNeed() {
+            return branchAddress == -1 ? -1 : 1;
+        }
+
+        /**
+         * adds the addresses of the branches that emitSetOnCondition rewrites.
+         */
+        virtual void addBranchAddresses(vector<int> &addresses) {
+            if (branchAddress == -1) return;
+            addresses.push_back(branchAddress);
+            addresses.push_back(branchAddress + 1);
+        }
+
+        /**
+         * rewrites the branches of a boolean expression to compute its value into [valueReg], one of the
+         * registers of [pool]. returns the address of the command that completes the value.
+         */
+        virtual int emitSetOnCondition(vector<string> &pool, string &valueReg) {
+            valueReg = pool.back();
+            pool.pop_back();
+            codeBuffer.replace(branchAddress, "move " + valueReg + ", " + testedRegister);
+            codeBuffer.replace(branchAddress + 1, "");
+            return branchAddress;
+        }
+
+        /**
+         * adds the temporary registers that this expression holds and will read when it is evaluated.
+         */
+        virtual void heldRegisters(vector<string> &regs) {
+            if (registerName != "" && !registers.isHome(registerName)) regs.push_back(registerName);
+        }
+
+        /**
+         * evaluates the expression straight into [destReg], e.g the register of a variable.
+         */
+        virtual void evaluateTo(string destReg) {
+            string reg = evaluate();
+            if (reg != destReg) assembler.move(destReg, reg);
+            registers.regFree(reg);
+        }
+
         bool isBoolean() {
             return this->type->typeName() == BooleanType().typeName();
         }
@@ -281,6 +410,8 @@ namespace FanC {
         Expression *leftExp;
         Expression *rightExp;
         Operation *op;
+        vector<VariableFact> trueFacts;
+        bool isRhsSideEffectFree; //of an and/or, the rhs may be evaluated even when it is short-circuited
 
         Id *isPreconditionable() {
             Id *id = leftExp->isPreconditionable();
@@ -290,10 +421,12 @@ namespace FanC {
         }
 
         BinaryExpression(Expression *_leftExp, Expression *_rightExp, Operation *_op)
-                : Expression(NULL), leftExp(_leftExp), rightExp(_rightExp), op(_op) {
+                : Expression(NULL), leftExp(_leftExp), rightExp(_rightExp), op(_op), isRhsSideEffectFree(false) {
             if (isInstanceOf<Relop>(_op)) {
                 if (leftExp->isNumric() && rightExp->isNumric()) {
                     this->type = new BooleanType();
+                    learnTrueFacts(); //before the literal is loaded
+                    evaluateOperands();
                     string _operation = ((Relop *) _op)->op;
                     int cmdAddress;
                     if (_operation == "==") {
@@ -310,6 +443,7 @@ namespace FanC {
                     } else { // _operation is >
                         cmdAddress = assembler.bgt(leftExp->registerName, rightExp->registerName);
                     }
+                    branchAddress = cmdAddress;
                     this->trueList = codeBuffer.makelist(cmdAddress);
                     this->falseList = codeBuffer.makelist(assembler.j());
                     registers.regFree(leftExp->registerName);
@@ -324,45 +458,163 @@ namespace FanC {
             } else if (isInstanceOf<Multiplicative>(_op) || isInstanceOf<Additive>(_op)) {
                 if (leftExp->isNumric() && rightExp->isNumric()) {
                     this->type = getLargerType();
-                    this->registerName = leftExp->registerName;
-                    string _operator = ((BinaryOperation *) _op)->op;
-                    if (isInstanceOf<Multiplicative>(_op)) {
-                        if (_operator == "*") {
-                            assembler.mul(registerName, leftExp->registerName, rightExp->registerName);
-                        } else if (_operator == "/") {
-                            assembler.div(registerName, leftExp->registerName, rightExp->registerName);
-                        }
-
-                    } else { //Additive
-                        if (_operator == "+")
-                            assembler.addu(registerName, leftExp->registerName, rightExp->registerName);
-                        else {
-                            assembler.subu(registerName, leftExp->registerName, rightExp->registerName);
-                        }
-
-                    }
+                    //a division that may trap must exit before the calls that follow it are made
+                    if (((BinaryOperation *) _op)->op == "/" && !rightExp->valueRange().excludesZero()) evaluate();
                 } else {
                     errorMismatch(yylineno);
                     exit(1);
                 }
+            }
 
-                if (this->type->typeName() == ByteType().typeName()) {
-                    assembler.andi(registerName, registerName, 255);
-                }
-                registers.regFree(rightExp->registerName);
+
+        }
+
+        void addTrueFacts(vector<VariableFact> &facts) {
+            facts.insert(facts.end(), trueFacts.begin(), trueFacts.end());
+        }
+
+        bool isIncrementOf(const string &name, int &step) {
+            if (!isInstanceOf<Additive>(op) || registerName != "" || constantOperand() == NULL) return false;
+            if (variableOperand()->variableName() != name) return false;
+            constantOperand()->isLiteral(step);
+            if (((BinaryOperation *) op)->op == "-") step = -step;
+            return true;
+        }
+
+        int setOnConditionNeed() {
+            if (!isInstanceOf<BooleanOperation>(op)) return Expression::setOnConditionNeed();
+            int leftNeed = leftExp->setOnConditionNeed();
+            int rightNeed = rightExp->setOnConditionNeed();
+            if (!isRhsSideEffectFree || leftNeed == -1 || rightNeed == -1) return -1;
+            //the value of the lhs is held while the rhs is computed
+            return max(leftNeed, rightNeed + 1);
+        }
+
+        void addBranchAddresses(vector<int> &addresses) {
+            if (!isInstanceOf<BooleanOperation>(op)) {
+                Expression::addBranchAddresses(addresses);
+                return;
+            }
+            leftExp->addBranchAddresses(addresses);
+            rightExp->addBranchAddresses(addresses);
+        }
+
+        int emitSetOnCondition(vector<string> &pool, string &valueReg) {
+            if (!isInstanceOf<BooleanOperation>(op)) {
+                valueReg = pool.back();
+                pool.pop_back();
+                codeBuffer.replace(branchAddress, AssemblerCoder::setOnCondition(((Relop *) op)->op, valueReg,
+                                                                                 leftExp->registerName,
+                                                                                 rightExp->registerName));
+                codeBuffer.replace(branchAddress + 1, "");
+                return branchAddress;
+            }
+            leftExp->emitSetOnCondition(pool, valueReg);
+            string rightReg;
+            int address = rightExp->emitSetOnCondition(pool, rightReg);
+            string _operator = ((BooleanOperation *) op)->op == And ? "and " : "or ";
+            codeBuffer.replace(address, codeBuffer.getCommand(address) + "\n" + _operator + valueReg + ", " +
+                                        valueReg + ", " + rightReg);
+            pool.push_back(rightReg);
+            return address;
+        }
+
+        ValueRange valueRange() {
+            return wrappedRange(leftExp->valueRange(), rightExp->valueRange());
+        }
+
+        ValueRange rangeWith(const map<string, ValueRange> &arguments) {
+            return wrappedRange(leftExp->rangeWith(arguments), rightExp->rangeWith(arguments));
+        }
+
+        int decide(const map<string, ValueRange> &arguments, vector<Reason> &reasons) {
+            if (isInstanceOf<BooleanOperation>(op)) {
+                //the rhs is decided only where it would be evaluated
+                int left = leftExp->decide(arguments, reasons);
+                if (left == -1) return -1;
+                if (left == (((BooleanOperation *) op)->op == And ? 0 : 1)) return left;
+                return rightExp->decide(arguments, reasons);
+            }
+            if (!isInstanceOf<Relop>(op)) return -1;
+            ValueRange left = leftExp->rangeWith(arguments);
+            ValueRange right = rightExp->rangeWith(arguments);
+            int decision = compareRanges(((Relop *) op)->op, left, right);
+            if (decision != -1) {
+                reasons.insert(reasons.end(), left.reasons.begin(), left.reasons.end());
+                reasons.insert(reasons.end(), right.reasons.begin(), right.reasons.end());
             }
+            return decision;
+        }
+
+        int registerNeed() {
+            if (registerName != "") return 1;
+            if (constantOperand() != NULL) return variableOperand()->registerNeed();
+            int leftNeed = leftExp->registerNeed();
+            int rightNeed = rightExp->registerNeed();
+            return leftNeed == rightNeed ? leftNeed + 1 : max(leftNeed, rightNeed);
+        }
+
+        string evaluate() {
+            if (registerName != "") return registerName;
+            if (constantOperand() != NULL) {
+                string operandReg = variableOperand()->evaluate();
+                registerName = registers.isHome(operandReg) ? registers.regAlloc() : operandReg;
+                emitConstantOperation(registerName);
+                if (registerName != operandReg) registers.regFree(operandReg);
+                return registerName;
+            }
+            evaluateOperands();
+            //registers of variables must not be overridden
+            if (!registers.isHome(leftExp->registerName)) {
+                registerName = leftExp->registerName;
+            } else if (!registers.isHome(rightExp->registerName)) {
+                registerName = rightExp->registerName;
+            } else {
+                registerName = registers.regAlloc();
+            }
+            emitOperation(registerName);
+            if (registerName != leftExp->registerName) registers.regFree(leftExp->registerName);
+            if (registerName != rightExp->registerName) registers.regFree(rightExp->registerName);
+            return registerName;
+        }
 
+        void heldRegisters(vector<string> &regs) {
+            if (registerName != "") {
+                Expression::heldRegisters(regs);
+                return;
+            }
+            leftExp->heldRegisters(regs);
+            rightExp->heldRegisters(regs);
+        }
 
+        void evaluateTo(string destReg) {
+            if (registerName != "") {
+                Expression::evaluateTo(destReg);
+                return;
+            }
+            if (constantOperand() != NULL) {
+                variableOperand()->evaluate();
+                emitConstantOperation(destReg);
+                registers.regFree(variableOperand()->registerName);
+                return;
+            }
+            evaluateOperands();
+            emitOperation(destReg);
+            registers.regFree(leftExp->registerName);
+            registers.regFree(rightExp->registerName);
         }
 
 
         BinaryExpression(Expression *_leftExp, Expression *_rightExp, BooleanOperation *_op, M *beforeRhsMarker)
-                : Expression(NULL), leftExp(_leftExp), rightExp(_rightExp), op(_op) {
+                : Expression(NULL), leftExp(_leftExp), rightExp(_rightExp), op(_op), isRhsSideEffectFree(false) {
             if (leftExp->isBoolean() && rightExp->isBoolean()) {
                 this->type = new BooleanType();
+                isRhsSideEffectFree = isCodeSideEffectFree(atoi(beforeRhsMarker->label.substr(6).c_str()), rightExp);
                 BoolOp b = _op->op;
                 switch (b) {
                     case And:
+                        leftExp->addTrueFacts(trueFacts);
+                        rightExp->addTrueFacts(trueFacts);
                         assembler.comment("start-AND backpatching:");
                         codeBuffer.bpatch(leftExp->trueList,beforeRhsMarker->label);
                         this->trueList=rightExp->trueList;
@@ -387,6 +639,212 @@ namespace FanC {
         }
 
     private:
+        static int compareRanges(const string &relation, const ValueRange &left, const ValueRange &right) {
+            if (relation == ">" || relation == ">=") {
+                return compareRanges(relation == ">" ? "<" : "<=", right, left);
+            }
+            if (relation == "<") {
+                if (left.high < right.low) return 1;
+                return left.low >= right.high ? 0 : -1;
+            }
+            if (relation == "<=") {
+                if (left.high <= right.low) return 1;
+                return left.low > right.high ? 0 : -1;
+            }
+            int equal = -1;
+            if (left.low == left.high && right.low == right.high && left.low == right.low) {
+                equal = 1;
+            } else if (left.high < right.low || right.high < left.low ||
+                       (right.low == 0 && right.high == 0 && left.excludesZero()) ||
+                       (left.low == 0 && left.high == 0 && right.excludesZero())) {
+                equal = 0;
+            }
+            if (relation == "==" || equal == -1) return equal;
+            return 1 - equal;
+        }
+
+        ValueRange wrappedRange(const ValueRange &left, const ValueRange &right) {
+            ValueRange typeRange = Expression::valueRange();
+            if (!isNumric()) return typeRange;
+            ValueRange range = operationRange(left, right);
+            //an int wraps around and a byte is masked
+            return range.isWithin(typeRange.low, typeRange.high) ? range : typeRange;
+        }
+
+        /**
+         * checks that the code from [start] on does nothing but computing values, apart from the branches of [exp].
+         */
+        bool isCodeSideEffectFree(int start, Expression *exp) {
+            vector<int> branches;
+            exp->addBranchAddresses(branches);
+            for (int address = start; address < codeBuffer.nextAddress(); address++) {
+                if (find(branches.begin(), branches.end(), address) != branches.end()) continue;
+                if (!AssemblerCoder::isSideEffectFree(codeBuffer.getCommand(address))) return false;
+            }
+            return true;
+        }
+
+        void emitOperation(string destReg) {
+            string _operator = ((BinaryOperation *) op)->op;
+            if (isInstanceOf<Multiplicative>(op)) {
+                if (_operator == "*") {
+                    assembler.mul(destReg, leftExp->registerName, rightExp->registerName);
+                } else if (_operator == "/") {
+                    int divAddress = assembler.div(destReg, leftExp->registerName, rightExp->registerName);
+                    ValueRange divisor = rightExp->valueRange();
+                    RangeAnalysis::getInstance().addCheck(divAddress - 1, "division by zero check",
+                                                          divisor.excludesZero(), divisor.reasons);
+                }
+
+            } else { //Additive
+                if (_operator == "+")
+                    assembler.addu(destReg, leftExp->registerName, rightExp->registerName);
+                else {
+                    assembler.subu(destReg, leftExp->registerName, rightExp->registerName);
+                }
+
+            }
+
+            emitByteMask(destReg);
+        }
+
+        void emitByteMask(string destReg) {
+            //a quotient of bytes is never larger than the dividend
+            if (this->type->typeName() != ByteType().typeName() || ((BinaryOperation *) op)->op == "/") return;
+            int address = assembler.andi(destReg, destReg, 255);
+            ValueRange range = operationRange(leftExp->valueRange(), rightExp->valueRange());
+            RangeAnalysis::getInstance().addCheck(address, "byte mask", range.isWithin(0, BYTE_MAX_VALUE), range.reasons);
+        }
+
+        /**
+         * the values of the arithmetic operation before it wraps around or is masked.
+         */
+        ValueRange operationRange(const ValueRange &left, const ValueRange &right) {
+            string _operator = ((BinaryOperation *) op)->op;
+            long long candidates[4];
+            if (_operator == "+") {
+                candidates[0] = candidates[1] = left.low + right.low;
+                candidates[2] = candidates[3] = left.high + right.high;
+            } else if (_operator == "-") {
+                candidates[0] = candidates[1] = left.low - right.high;
+                candidates[2] = candidates[3] = left.high - right.low;
+            } else if (_operator == "*") {
+                candidates[0] = left.low * right.low;
+                candidates[1] = left.low * right.high;
+                candidates[2] = left.high * right.low;
+                candidates[3] = left.high * right.high;
+            } else if (right.low > 0 || right.high < 0) {
+                candidates[0] = left.low / right.low;
+                candidates[1] = left.low / right.high;
+                candidates[2] = left.high / right.low;
+                candidates[3] = left.high / right.high;
+            } else {
+                //the quotient is never larger than the dividend, a zero divisor stops the program
+                candidates[0] = candidates[1] = min(left.low, -left.high);
+                candidates[2] = candidates[3] = max(left.high, -left.low);
+            }
+            ValueRange range(*min_element(candidates, candidates + 4), *max_element(candidates, candidates + 4));
+            range.addReasons(left);
+            range.addReasons(right);
+            return range;
+        }
+
+        /**
+         * a comparison of a variable with a literal narrows the variable's values where it is true.
+         */
+        void learnTrueFacts() {
+            string relation = ((Relop *) op)->op;
+            int value;
+            Expression *variable;
+            if (rightExp->isLiteral(value) && leftExp->variableName() != "") {
+                variable = leftExp;
+            } else if (leftExp->isLiteral(value) && rightExp->variableName() != "") {
+                variable = rightExp;
+                if (relation[0] == '<') relation[0] = '>';
+                else if (relation[0] == '>') relation[0] = '<';
+            } else {
+                return;
+            }
+            //a loop condition is tested again with the values the loop assigns, so only the type is relied on
+            ValueRange range = variable->Expression::valueRange();
+            if (relation == "<") {
+                range.high = min(range.high, (long long) value - 1);
+            } else if (relation == "<=") {
+                range.high = min(range.high, (long long) value);
+            } else if (relation == ">") {
+                range.low = max(range.low, (long long) value + 1);
+            } else if (relation == ">=") {
+                range.low = max(range.low, (long long) value);
+            } else if (relation == "==") {
+                range.low = max(range.low, (long long) value);
+                range.high = min(range.high, (long long) value);
+            } else { // !=
+                if (value == 0) range.isNonZero = true;
+                if (range.low == value) range.low++;
+                if (range.high == value) range.high--;
+            }
+            trueFacts.push_back(VariableFact(variable->variableName(), range));
+        }
+
+        /**
+         * arithmetic with a literal operand, the literal is used as an immediate or
+         * the operation is done with shifts (a literal divisor is known not to be zero).
+         */
+        Expression *constantOperand() {
+            if (!isInstanceOf<Multiplicative>(op) && !isInstanceOf<Additive>(op)) return NULL;
+            string _operator = ((BinaryOperation *) op)->op;
+            int value;
+            if (rightExp->isLiteral(value) && (_operator != "/" || value != 0)) return rightExp;
+            if (leftExp->isLiteral(value) && (_operator == "*" || _operator == "+")) return leftExp;
+            return NULL;
+        }
+
+        Expression *variableOperand() {
+            return constantOperand() == rightExp ? leftExp : rightExp;
+        }
+
+        void emitConstantOperation(string destReg) {
+            string _operator = ((BinaryOperation *) op)->op;
+            int value;
+            constantOperand()->isLiteral(value);
+            Expression *operand = variableOperand();
+            if (_operator == "*" || _operator == "/") {
+                string scratchReg = registers.regAlloc();
+                if (_operator == "*") {
+                    int start = codeBuffer.nextAddress();
+                    assembler.mulByConstant(destReg, operand->registerName, value, scratchReg);
+                    if (registers.isHome(operand->registerName) && operand->variableName() != "" &&
+                        isInstanceOf<IntType>(operand->type)) {
+                        LoopInvariants::getInstance().addMultiplication(operand->variableName(), operand->registerName,
+                                                                        value, destReg, start);
+                    }
+                } else {
+                    bool isNonNegative = operand->type->typeName() == ByteType().typeName();
+                    assembler.divByConstant(destReg, operand->registerName, value, isNonNegative, scratchReg);
+                }
+                registers.regFree(scratchReg);
+            } else if (_operator == "+") {
+                assembler.addu(destReg, operand->registerName, value);
+            } else {
+                assembler.subu(destReg, operand->registerName, value);
+            }
+            emitByteMask(destReg);
+        }
+
+        /**
+         * evaluates the operand that needs more registers first, so the other operand's
+         * value is held in a register for a shorter time (Sethi-Ullman order).
+         */
+        void evaluateOperands() {
+            if (rightExp->registerNeed() > leftExp->registerNeed()) {
+                rightExp->evaluate();
+                leftExp->evaluate();
+            } else {
+                leftExp->evaluate();
+                rightExp->evaluate();
+            }
+        }
+
         ReturnType *getLargerType() {
             if (isSameType<ByteType>(leftExp->type, rightExp->type)
                 || isSameType<IntType>(leftExp->type, rightExp->type)) {
@@ -428,6 +886,33 @@ namespace FanC {
             falseList = exp->trueList;
         }
 
+        int setOnConditionNeed() {
+            return exp->setOnConditionNeed();
+        }
+
+        void addBranchAddresses(vector<int> &addresses) {
+            exp->addBranchAddresses(addresses);
+        }
+
+        int decide(const map<string, ValueRange> &arguments, vector<Reason> &reasons) {
+            int decision = exp->decide(arguments, reasons);
+            return decision == -1 ? -1 : 1 - decision;
+        }
+
+        int emitSetOnCondition(vector<string> &pool, string &valueReg) {
+            int address = exp->emitSetOnCondition(pool, valueReg);
+            string command = codeBuffer.getCommand(address);
+            string negation = "\nxori " + valueReg + ", " + valueReg + ", 1";
+            //a negated negation cancels out
+            if (command.size() > negation.size() &&
+                command.compare(command.size() - negation.size(), negation.size(), negation) == 0) {
+                codeBuffer.replace(address, command.substr(0, command.size() - negation.size()));
+            } else {
+                codeBuffer.replace(address, command + negation);
+            }
+            return address;
+        }
+
         Id *isPreconditionable() {
             return NULL;
         }
@@ -477,13 +962,29 @@ namespace FanC {
         bool value;
 
         explicit Boolean(bool val) : UnaryExpression(new BooleanType()), value(val) {
+            branchAddress = assembler.j();
             if (val) {
-                trueList = codeBuffer.makelist(assembler.j());
+                trueList = codeBuffer.makelist(branchAddress);
             } else {
-                falseList = codeBuffer.makelist(assembler.j());
+                falseList = codeBuffer.makelist(branchAddress);
             }
         }
 
+        void addBranchAddresses(vector<int> &addresses) {
+            addresses.push_back(branchAddress);
+        }
+
+        int decide(const map<string, ValueRange> &arguments, vector<Reason> &reasons) {
+            return value ? 1 : 0;
+        }
+
+        int emitSetOnCondition(vector<string> &pool, string &valueReg) {
+            valueReg = pool.back();
+            pool.pop_back();
+            codeBuffer.replace(branchAddress, "li " + valueReg + ", " + (value ? "1" : "0"));
+            return branchAddress;
+        }
+
         Id *isPreconditionable() {
             return NULL;
         }
@@ -497,20 +998,25 @@ namespace FanC {
     public:
         string name;
         int offset;
+        string homeRegister; //the register that holds the variable, "" if it lives in the stack
         IdentifierType idType;
+        ValueRange knownRange; //what is known about the variable's value where it is read
 
         friend bool operator==(const Id &, const Id &);
 
         friend bool operator!=(const Id &, const Id &);
 
-        explicit Id(string text) : UnaryExpression(new Type()), name(text), idType(VariableType) {}
+        explicit Id(string text) : UnaryExpression(new Type()), name(text), idType(VariableType),
+                                   knownRange(INT_MIN_VALUE, INT_MAX_VALUE) {}
 
         Id(string text, ReturnType *_type, IdentifierType _idType) : UnaryExpression(_type),
-                                                                     name(text), idType(_idType) {}
+                                                                     name(text), idType(_idType),
+                                                                     knownRange(INT_MIN_VALUE, INT_MAX_VALUE) {}
 
-        explicit Id(Id *id) : UnaryExpression(id->type->clone()) {
+        explicit Id(Id *id) : UnaryExpression(id->type->clone()), knownRange(INT_MIN_VALUE, INT_MAX_VALUE) {
             name = id->name;
             offset = id->offset;
+            homeRegister = id->homeRegister;
             idType = id->idType;
         }
 
@@ -519,6 +1025,56 @@ namespace FanC {
             return this;
         }
 
+        string variableName() {
+            return name;
+        }
+
+        ValueRange valueRange() {
+            ValueRange range = Expression::valueRange();
+            if (knownRange.reasons.empty()) return range;
+            range.low = max(range.low, knownRange.low);
+            range.high = min(range.high, knownRange.high);
+            range.isNonZero = knownRange.isNonZero;
+            range.addReasons(knownRange);
+            return range;
+        }
+
+        ValueRange rangeWith(const map<string, ValueRange> &arguments) {
+            map<string, ValueRange>::const_iterator argument = arguments.find(name);
+            return argument == arguments.end() ? valueRange() : argument->second;
+        }
+
+        /**
+         * a boolean variable is decided by an argument that is known to be true (1) or false (0).
+         */
+        int decide(const map<string, ValueRange> &arguments, vector<Reason> &reasons) {
+            map<string, ValueRange>::const_iterator argument = arguments.find(name);
+            if (!isBoolean() || argument == arguments.end() || argument->second.low != argument->second.high) return -1;
+            reasons.insert(reasons.end(), argument->second.reasons.begin(), argument->second.reasons.end());
+            return argument->second.low;
+        }
+
+        string evaluate() {
+            if (registerName == "") {
+                if (homeRegister != "") {
+                    registerName = homeRegister;
+                } else {
+                    registerName = registers.regAlloc();
+                    /* the loading from frame pointer will work only since there are no global variables */
+                    assembler.lw(registerName, offset * (-WORD_SIZE));
+                }
+            }
+            return registerName;
+        }
+
+        void evaluateTo(string destReg) {
+            if (registerName == "" && homeRegister == "") {
+                assembler.lw(destReg, offset * (-WORD_SIZE));
+            } else {
+                Expression::evaluateTo(destReg);
+            }
+        }
+
         Id *changeIdTypeToFunction() {
             idType = FunctionType;
             return this;
@@ -545,11 +1101,26 @@ namespace FanC {
 
         explicit String(string text) : UnaryExpression(new StringType()), value(text), label("") {
             //label = CodeBuffer::instance().genLabel();
-            label = assembler.genDataLabel();
-            assembler.emitStringToDataForString(label, value);
-            registerName = registers.regAlloc();
-            assembler.la(registerName, label);
+            label = assembler.internString(value.substr(1, value.size() - 2));
+        }
 
+        string evaluate() {
+            if (registerName == "") {
+                registerName = LoopInvariants::getInstance().loadConstant("la", label);
+            }
+            if (registerName == "") {
+                registerName = registers.regAlloc();
+                assembler.la(registerName, label);
+            }
+            return registerName;
+        }
+
+        void evaluateTo(string destReg) {
+            if (registerName == "") {
+                assembler.la(destReg, label);
+            } else {
+                Expression::evaluateTo(destReg);
+            }
         }
 
 
@@ -566,9 +1137,35 @@ namespace FanC {
 
         Number(string text, Type *_type) : UnaryExpression(_type), value(atoi(text.c_str())) {}
 
-        Number(int val, Type *_type) : UnaryExpression(_type), value(val) {
-            registerName = registers.regAlloc();
-            assembler.li(registerName, val);
+        Number(int val, Type *_type) : UnaryExpression(_type), value(val) {}
+
+        ValueRange valueRange() {
+            ValueRange range(value, value);
+            return range;
+        }
+
+        bool isLiteral(int &literalValue) {
+            literalValue = value;
+            return registerName == "";
+        }
+
+        string evaluate() {
+            if (registerName == "") {
+                registerName = LoopInvariants::getInstance().loadConstant("li", AssemblerCoder::to_string(value));
+            }
+            if (registerName == "") {
+                registerName = registers.regAlloc();
+                assembler.li(registerName, value);
+            }
+            return registerName;
+        }
+
+        void evaluateTo(string destReg) {
+            if (registerName == "") {
+                assembler.li(destReg, value);
+            } else {
+                Expression::evaluateTo(destReg);
+            }
         }
 
         Id *isPreconditionable() {
@@ -739,6 +1336,11 @@ namespace FanC {
         Id *id;
         FormalList *arguments;
         PreConditions *conditions;
+        vector<string> inlineBody; //the code of a small function, copied into its call sites instead of calling it
+        //the checks of the preconditions reading the arguments where they are passed, empty if they can't be moved
+        vector<string> entryChecks;
+        int entryChecksAddress; //where the checks were emitted, their labels are relative to it
+        bool hasUncheckedEntry; //the checks run before the frame is set up, a caller that proves them skips them
 
         friend bool operator==(const FuncDec &, const FuncDec &);
 
@@ -750,7 +1352,8 @@ namespace FanC {
                 PreConditions *_conditions) : returnType(_returnType),
                                               id(_id),
                                               arguments(_arguments),
-                                              conditions(_conditions) {}
+                                              conditions(_conditions), inlineBody(), entryChecks(),
+                                              entryChecksAddress(-1), hasUncheckedEntry(false) {}
 
 
         vector<string> *getArgsAsString() {
@@ -799,34 +1402,69 @@ namespace FanC {
     public:
         Id *id;
         ExpressionList *expressions;
-
-        Call(ReturnType *_returnType, Id *_id, ExpressionList *_expressions)
-                : UnaryExpression(_returnType->clone()), id(_id), expressions(_expressions) {
+        bool isInlined;
+        bool savedRegisters; //registers were saved in the stack around the call
+        int jalAddress;
+        int frameSlots; //the slots at the bottom of the caller's frame the call uses for arguments and saved registers
+
+        Call(ReturnType *_returnType, Id *_id, ExpressionList *_expressions,
+             const vector<string> &inlineBody = vector<string>())
+                : UnaryExpression(_returnType->clone()), id(_id), expressions(_expressions), isInlined(false),
+                  savedRegisters(false), jalAddress(-1), frameSlots(0) {
+            map<string, string> substitutes;
+            if (canInline(inlineBody, substitutes)) {
+                emitInline(inlineBody, substitutes);
+                return;
+            }
             assembler.comment("call to function - saving regs");
-            vector<string> used = registers.getUsedRegisters();
-            saveAndFreeRegs(used);
-            assembler.subu("$sp", "$sp", WORD_SIZE * 2);
-            assembler.sw("$fp", WORD_SIZE, "$sp");
-            assembler.sw("$ra", 0, "$sp");
+            vector<string> argumentRegs;
+            for (int i = 0; i < expressions->expressions.size(); i++) {
+                expressions->expressions[i]->heldRegisters(argumentRegs);
+            }
+            //only temporaries that hold a value after the call are saved, the stored registers are callee saved
+            vector<string> live = subtract(registers.getUsedTempRegisters(), argumentRegs);
+            live = subtract(live, LoopInvariants::getInstance().constantRegisters());
+            //the first arguments are passed in $a0-$a3, the rest at the bottom of the frame
             int argsSize = expressions->expressions.size();
-            assembler.subu("$sp", "$sp", WORD_SIZE * argsSize);
-            for (int i = 0; i < argsSize; i++) {
-                string &reg = expressions->expressions[i]->registerName;
-                assembler.sw(reg, i * WORD_SIZE, "$sp");
+            int stackArgsSize = max(argsSize - ARGUMENT_REG_NUM, 0);
+            RestoreCode &lastRestore = getLastRestore();
+            RestoreCode keptSaved;
+            keptSaved.endSlot = stackArgsSize;
+            if (isFollowingLastCall(lastRestore, argumentRegs) && stackArgsSize <= lastRestore.startSlot) {
+                //the registers of the previous call are still saved in the stack, keep them there
+                for (int i = 0; i < lastRestore.addresses.size(); i++) {
+                    codeBuffer.replace(lastRestore.addresses[i], "");
+                }
+                keptSaved = lastRestore;
+                live = subtract(live, keptSaved.regs);
+            }
+            saveRegs(live, keptSaved.endSlot);
+            savedRegisters = !live.empty() || !keptSaved.regs.empty();
+            frameSlots = keptSaved.endSlot + live.size();
+            for (int i = ARGUMENT_REG_NUM; i < argsSize; i++) {
+                string reg = expressions->expressions[i]->evaluate();
+                assembler.sw(reg, (i - ARGUMENT_REG_NUM) * WORD_SIZE, "$sp");
                 Registers::getInstance().regFree(reg);
             }
-            assembler.subu("$fp","$sp",WORD_SIZE);//we didnt load the new fp
+            for (int i = 0; i < argsSize && i < ARGUMENT_REG_NUM; i++) {
+                expressions->expressions[i]->evaluateTo(Registers::argumentRegister(i));
+            }
             assembler.comment("jump to function - " + id->name);
-            assembler.jal(id->name);
+            jalAddress = assembler.jal(id->name);
+            LoopInvariants::getInstance().reloadConstants();
             assembler.comment("return from functionn  - " + id->name + " restoring the regs");
-            assembler.addu("$sp", "$sp", WORD_SIZE * argsSize);
-            assembler.lw("$ra", 0, "$sp");
-            assembler.lw("$fp", WORD_SIZE, "$sp");
-            assembler.addu("$sp", "$sp", WORD_SIZE * 2);
-            restoreRegs(used);
+            lastRestore = restoreRegs(live, keptSaved);
             assembler.comment("end Call");
         }
 
+        /**
+         * a call whose arguments are all in registers and that saved nothing around it can be the last
+         * thing its caller does - the caller's frame is released before jumping to the function.
+         */
+        bool isTailCallable() {
+            return !isInlined && !savedRegisters && expressions->expressions.size() <= ARGUMENT_REG_NUM;
+        }
+
         Id *isPreconditionable() {
 
             vector<Expression *>::iterator it = expressions->expressions.begin();
@@ -848,21 +1486,144 @@ namespace FanC {
 
     private:
 
-        void restoreRegs(vector<string> &regs) {
-            assembler.comment("restore all used regs");
+        /**
+         * the code that restores the saved registers after a call.
+         */
+        struct RestoreCode {
+            vector<string> regs;
+            vector<string> commands;
+            vector<int> addresses;
+            int end;
+            int startSlot; //the registers are saved in the frame's slots [startSlot, endSlot) from $sp
+            int endSlot;
+
+            RestoreCode() : regs(), commands(), addresses(), end(-1), startSlot(0), endSlot(0) {}
+        };
+
+        /**
+         * the copied code uses temporaries that are free here instead of the ones it was generated with.
+         */
+        bool canInline(const vector<string> &inlineBody, map<string, string> &substitutes) {
+            if (inlineBody.empty()) return false;
+            vector<string> freeRegs = registers.getFreeTempRegisters();
+            string code;
+            for (int i = 0; i < inlineBody.size(); i++) code += inlineBody[i] + "\n";
+            vector<string> bodyRegs;
+            for (int i = TEMP_REG_START; i < TEMP_REG_END; i++) {
+                string reg = "$t" + AssemblerCoder::to_string(i);
+                if (code.find(reg) == string::npos) continue;
+                vector<string>::iterator found = find(freeRegs.begin(), freeRegs.end(), reg);
+                if (found != freeRegs.end()) {
+                    substitutes[reg] = reg;
+                    freeRegs.erase(found);
+                } else {
+                    bodyRegs.push_back(reg);
+                }
+            }
+            if (bodyRegs.size() > freeRegs.size()) return false;
+            for (int i = 0; i < bodyRegs.size(); i++) substitutes[bodyRegs[i]] = freeRegs[i];
+            return true;
+        }
+
+        void emitInline(const vector<string> &inlineBody, map<string, string> &substitutes) {
+            assembler.comment("inlined call to function - " + id->name);
+            //the arguments may load loop constants, they must not take the temporaries of the copied code
+            vector<string> bodyRegs;
+            for (map<string, string>::iterator it = substitutes.begin(); it != substitutes.end(); ++it) {
+                bodyRegs.push_back(it->second);
+            }
+            LoopInvariants::getInstance().keepFree(bodyRegs);
+            for (int i = 0; i < expressions->expressions.size(); i++) {
+                expressions->expressions[i]->evaluateTo(Registers::argumentRegister(i));
+            }
+            LoopInvariants::getInstance().keepFree(vector<string>());
+            int start = codeBuffer.nextAddress();
+            int end = start + inlineBody.size();
+            //returning is continuing after the copied code, the returns at its end just fall through
+            int lastReturn = inlineBody.size();
+            while (lastReturn > 0 && isSkippedOnReturn(inlineBody[lastReturn - 1])) lastReturn--;
+            bool jumpsToEnd = false;
+            for (int i = 0; i < inlineBody.size(); i++) {
+                string command = inlineBody[i];
+                if (command == "jr $ra") {
+                    jumpsToEnd = jumpsToEnd || i < lastReturn;
+                    command = i < lastReturn ? "j label_" + AssemblerCoder::to_string(end) : "";
+                } else {
+                    command = CodeBuffer::relocateLabels(Registers::rename(command, substitutes), start);
+                }
+                codeBuffer.emit(command);
+            }
+            if (jumpsToEnd) codeBuffer.genLabel();
+            assembler.comment("end inlined call");
+            isInlined = true;
+        }
+
+        static bool isSkippedOnReturn(const string &command) {
+            return command == "" || command[0] == '#' || command == "jr $ra";
+        }
+
+        static RestoreCode &getLastRestore() {
+            static RestoreCode lastRestore;
+            return lastRestore;
+        }
+
+        static vector<string> subtract(const vector<string> &regs, const vector<string> &toRemove) {
+            vector<string> result;
             for (int i = 0; i < regs.size(); i++) {
-                assembler.lw(regs[i], WORD_SIZE * i, "$sp");
-                //registers.markAsUsed(regs[i]);
+                if (find(toRemove.begin(), toRemove.end(), regs[i]) == toRemove.end()) result.push_back(regs[i]);
             }
-            assembler.addu("$sp", "$sp", regs.size() * WORD_SIZE);
+            return result;
         }
 
-        void saveAndFreeRegs(vector<string> &regs) {
+        /**
+         * checks if this call directly follows the last call - only the previous result was moved
+         * out of $v0 since its registers were restored, and the arguments do not read them.
+         */
+        bool isFollowingLastCall(RestoreCode &lastRestore, vector<string> &argumentRegs) {
+            if (lastRestore.regs.empty()) return false;
+            if (subtract(lastRestore.regs, argumentRegs).size() != lastRestore.regs.size()) return false;
+            for (int address = lastRestore.end; address < codeBuffer.nextAddress(); address++) {
+                string command = codeBuffer.getCommand(address);
+                if (command == "" || command[0] == '#') continue;
+                if (command.find("move ") != 0 || command.find(", $v0") != command.size() - 5) return false;
+                string destReg = command.substr(5, command.find(',') - 5);
+                if (find(lastRestore.regs.begin(), lastRestore.regs.end(), destReg) != lastRestore.regs.end())
+                    return false;
+            }
+            return true;
+        }
+
+        RestoreCode restoreRegs(vector<string> &regs, RestoreCode &keptSaved) {
+            RestoreCode restore;
+            if (!regs.empty()) {
+                assembler.comment("restore all used regs");
+                for (int i = 0; i < regs.size(); i++) {
+                    int slot = keptSaved.endSlot + i;
+                    restore.commands.push_back(codeBuffer.getCommand(assembler.lw(regs[i], WORD_SIZE * slot, "$sp")));
+                    restore.addresses.push_back(codeBuffer.nextAddress() - 1);
+                }
+            }
+            //the registers of the previous calls are saved under the registers of this call
+            for (int i = 0; i < keptSaved.commands.size(); i++) {
+                restore.commands.push_back(keptSaved.commands[i]);
+                restore.addresses.push_back(codeBuffer.emit(keptSaved.commands[i]));
+            }
+            restore.regs = regs;
+            restore.regs.insert(restore.regs.end(), keptSaved.regs.begin(), keptSaved.regs.end());
+            restore.end = codeBuffer.nextAddress();
+            restore.startSlot = keptSaved.regs.empty() ? keptSaved.endSlot : keptSaved.startSlot;
+            restore.endSlot = keptSaved.endSlot + regs.size();
+            return restore;
+        }
+
+        /**
+         * the registers are saved in the caller's frame, from [firstSlot] above the bottom of the frame.
+         */
+        void saveRegs(vector<string> &regs, int firstSlot) {
+            if (regs.empty()) return;
             assembler.comment("save all used regs");
-            assembler.subu("$sp", "$sp", regs.size() * WORD_SIZE);
             for (int i = 0; i < regs.size(); i++) {
-                assembler.sw(regs[i], WORD_SIZE * i, "$sp");
-                //registers.regFree(regs[i]);
+                assembler.sw(regs[i], WORD_SIZE * (firstSlot + i), "$sp");
             }
 
         }
@@ -873,6 +1634,7 @@ namespace FanC {
         vector<Id *> variables;
         vector<FuncDec *> functions;
         Scope *parent;
+        vector<VariableFact> facts; //what is known about variables in this scope, until they are assigned
 
         Scope() : variables(), functions(), parent(NULL) {
         }
@@ -885,6 +1647,27 @@ namespace FanC {
             variables.push_back(id);
         }
 
+        void addFact(const VariableFact &fact) {
+            facts.push_back(fact);
+        }
+
+        VariableFact *getFact(const string &name) {
+            for (int i = facts.size() - 1; i >= 0; i--) {
+                if (facts[i].name == name) return &facts[i];
+            }
+            return NULL == parent ? NULL : parent->getFact(name);
+        }
+
+        /**
+         * forgets what was known about the variable in this scope and in the scopes that contain it.
+         */
+        void killFacts(const string &name) {
+            for (int i = facts.size() - 1; i >= 0; i--) {
+                if (facts[i].name == name) facts.erase(facts.begin() + i);
+            }
+            if (NULL != parent) parent->killFacts(name);
+        }
+
         void addFunction(FuncDec *func) {
 
             func->id->changeIdTypeToFunction();
@@ -0,0 +1,513 @@
+#ifndef HW3_PROFILE_HPP
+#define HW3_PROFILE_HPP
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include "bp.hpp"
+#include "assembler_coder.hpp"
+
+using namespace std;
+
+#define PROFILE_COUNTS_LABEL "profile_counts"
+#define PROFILE_KEY_LABEL_PREFIX "profile_key_"
+#define PROFILE_DUMP_LABEL "profile_dump"
+#define PROFILE_HEADER "#profile"
+#define BLOCK_LABEL_INFIX "_block_"
+#define INLINED_CALL_COMMENT "#inlined call to function - "
+#define END_INLINED_CALL_COMMENT "#end inlined call"
+#define HOT_CALLS 100 //a function called this many times in the profiled runs may be inlined when it is twice as big
+
+/**
+ * profile guided optimization. with --instrument, every basic block of the functions and every call counts the
+ * times it runs in a word of the data, and the program prints the counts when it exits, after "#profile".
+ * with --profile-use=<file>, the counts of such a run lay the blocks that never ran in a cold section at the
+ * end of the program, out of the way of the ones that did, and decide which functions are inlined.
+ * the blocks are numbered in the order of the code, so a function is laid out only if its code has as many
+ * blocks as it had when it was profiled. the inlined calls are not split into blocks, the inlining decisions
+ * that the profile changes do not change the numbers.
+ */
+class Profile {
+private:
+    //a place a counter is added at, before the command at [address]
+    struct CounterPoint {
+        int address;
+        int firstAddress; //where the block starts, its labels come before the counted command
+        string key; //"block <function> <number>" or "call <caller> <callee>"
+
+        CounterPoint(int _address, int _firstAddress, const string &_key)
+                : address(_address), firstAddress(_firstAddress), key(_key) {}
+    };
+
+    //one command of the laid out code, a line of the buffer may have several
+    struct Command {
+        int address;
+        string text;
+        bool isRemoved;
+
+        Command(int _address, const string &_text) : address(_address), text(_text), isRemoved(false) {}
+    };
+
+    bool isInstrumentingCode;
+    bool isProfileLoaded;
+    map<string, long long> counts; //the profiled count of every key
+    map<string, int> blocksCounts; //the number of blocks every profiled function had
+    map<string, int> labelAddresses;
+    vector<pair<string, int> > functions; //the functions' names and the addresses of their labels
+    int blocksCount;
+    int callsCount;
+    int laidOutCount;
+    int skippedCount;
+    int movedCount;
+    int coldCallsCount;
+    int hotCallsCount;
+
+    Profile() : isInstrumentingCode(false), isProfileLoaded(false), counts(), blocksCounts(), labelAddresses(),
+                functions(), blocksCount(0), callsCount(0), laidOutCount(0), skippedCount(0), movedCount(0),
+                coldCallsCount(0), hotCallsCount(0) {}
+
+    static vector<string> splitLines(const string &command) {
+        vector<string> parts;
+        stringstream lines(command);
+        string part;
+        while (getline(lines, part)) {
+            if (part != "") parts.push_back(part);
+        }
+        return parts;
+    }
+
+    static bool isLabel(const string &command) {
+        return command != "" && command[0] != '#' && command.find('\n') == string::npos
+               && command[command.size() - 1] == ':';
+    }
+
+    static bool isInstruction(const string &command) {
+        return command != "" && command[0] != '#' && !isLabel(command);
+    }
+
+    static string lastCommand(const string &command) {
+        return command.substr(command.rfind('\n') + 1);
+    }
+
+    static string opcodeOf(const string &command) {
+        return command.substr(0, command.find(' '));
+    }
+
+    //the label a jump or a branch goes to
+    static string targetOf(const string &command) {
+        return command.substr(command.rfind(' ') + 1);
+    }
+
+    static bool isBranch(const string &command) {
+        return command[0] == 'b' && command.find(' ') != string::npos;
+    }
+
+    static bool isLeaving(const string &command) {
+        string opcode = opcodeOf(command);
+        return opcode == "j" || opcode == "jr";
+    }
+
+    void findLabels(int end) {
+        labelAddresses.clear();
+        for (int address = 0; address < end; address++) {
+            vector<string> parts = splitLines(CodeBuffer::instance().getCommand(address));
+            for (int i = 0; i < parts.size(); i++) {
+                if (parts[i][0] != '#' && parts[i][parts[i].size() - 1] == ':') {
+                    labelAddresses[parts[i].substr(0, parts[i].size() - 1)] = address;
+                }
+            }
+        }
+    }
+
+    //the function whose code has the label, or the label itself if it is out of the functions
+    string functionOf(const string &label) {
+        map<string, int>::iterator found = labelAddresses.find(label);
+        if (found == labelAddresses.end() || functions.empty() || found->second < functions[0].second) return label;
+        int owner = 0;
+        while (owner + 1 < functions.size() && functions[owner + 1].second <= found->second) owner++;
+        return functions[owner].first;
+    }
+
+    bool isFunction(const string &label) {
+        for (int i = 0; i < functions.size(); i++) {
+            if (functions[i].first == label) return true;
+        }
+        return false;
+    }
+
+    int functionEnd(int function) {
+        return function + 1 < functions.size() ? functions[function + 1].second : CodeBuffer::instance().nextAddress();
+    }
+
+    /**
+     * the places of the counters of the function's code. a block starts at a label and after a jump or a
+     * branch, a call is counted where it is made.
+     */
+    vector<CounterPoint> findCounterPoints(int function) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        const string &name = functions[function].first;
+        vector<CounterPoint> points;
+        int blockStart = -1; //the first label of the block that was not counted yet
+        bool isAfterJump = false;
+        int inlinedDepth = 0;
+        string previous;
+        for (int address = functions[function].second; address < functionEnd(function); address++) {
+            string command = codeBuffer.getCommand(address);
+            if (command == "") continue;
+            bool isStartingBlock = blockStart != -1 || isAfterJump;
+            if (command.find(INLINED_CALL_COMMENT) == 0) {
+                if (inlinedDepth++ == 0 && isStartingBlock) {
+                    points.push_back(CounterPoint(address, blockStart == -1 ? address : blockStart,
+                                                  blockKey(name, points)));
+                    blockStart = -1;
+                    isAfterJump = false;
+                }
+                string callee = command.substr(string(INLINED_CALL_COMMENT).size());
+                points.push_back(CounterPoint(address, address, "call " + name + " " + callee));
+                continue;
+            }
+            if (command == END_INLINED_CALL_COMMENT) {
+                inlinedDepth--;
+                continue;
+            }
+            if (command[0] == '#') continue;
+            if (isLabel(command)) {
+                if (blockStart == -1 && inlinedDepth == 0) blockStart = address;
+                continue;
+            }
+            //the inlined code is a block of the caller whether it is inlined or not, only its calls are counted
+            if (isStartingBlock && inlinedDepth == 0) {
+                points.push_back(CounterPoint(address, blockStart == -1 ? address : blockStart,
+                                              blockKey(name, points)));
+            }
+            vector<string> parts = splitLines(command);
+            for (int i = 0; i < parts.size(); i++) {
+                string opcode = opcodeOf(parts[i]);
+                if (opcode == "jal" || (opcode == "j" && isFunction(targetOf(parts[i])))) {
+                    points.push_back(CounterPoint(address, address,
+                                                  "call " + name + " " + functionOf(targetOf(parts[i]))));
+                }
+            }
+            if (inlinedDepth > 0) continue;
+            string last = lastCommand(command);
+            blockStart = -1;
+            //the program exits by a syscall, or in the instrumented code by a jump to the counts' printing
+            isAfterJump = (isBranch(last) || isLeaving(last) || (last == "syscall" && previous == "li $v0, 10"));
+            previous = last;
+        }
+        return points;
+    }
+
+    static string blockKey(const string &function, const vector<CounterPoint> &points) {
+        int number = 0;
+        for (int i = 0; i < points.size(); i++) {
+            if (points[i].key.find("block ") == 0) number++;
+        }
+        return "block " + function + " " + AssemblerCoder::to_string(number);
+    }
+
+    static string counterCode(int counter) {
+        string offset = AssemblerCoder::to_string(counter * WORD_SIZE);
+        return string("la $k1, ") + PROFILE_COUNTS_LABEL + "\nlw $k0, " + offset + "($k1)\naddu $k0, $k0, 1\n"
+               + "sw $k0, " + offset + "($k1)";
+    }
+
+    /**
+     * prints the header, then every key with its count, and exits.
+     */
+    void emitDump(const vector<string> &keys, int keySize) {
+        AssemblerCoder &assembler = AssemblerCoder::getInstance();
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string loopLabel = string(PROFILE_DUMP_LABEL) + "_loop";
+        assembler.addLable(PROFILE_DUMP_LABEL);
+        assembler.la("$a0", assembler.internString(PROFILE_HEADER "\\n"));
+        assembler.printSyscall();
+        assembler.la("$t0", PROFILE_COUNTS_LABEL);
+        assembler.la("$t1", PROFILE_KEY_LABEL_PREFIX "0");
+        assembler.li("$t2", keys.size());
+        assembler.addLable(loopLabel);
+        assembler.move("$a0", "$t1");
+        assembler.printSyscall();
+        codeBuffer.emit("lw $a0, 0($t0)");
+        assembler.printiSyscall();
+        assembler.la("$a0", assembler.internString("\\n"));
+        assembler.printSyscall();
+        codeBuffer.emit("addu $t0, $t0, " + AssemblerCoder::to_string(WORD_SIZE));
+        codeBuffer.emit("addu $t1, $t1, " + AssemblerCoder::to_string(keySize));
+        codeBuffer.emit("subu $t2, $t2, 1");
+        codeBuffer.emit("bne $t2, $0, " + loopLabel);
+        assembler.li("$v0", 10);
+        codeBuffer.emit("syscall");
+    }
+
+    //the label the block starts with, one is added if it has none
+    string blockLabel(int function, const CounterPoint &block) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        string first = codeBuffer.getCommand(block.firstAddress);
+        if (isLabel(first)) return first.substr(0, first.size() - 1);
+        string label = functions[function].first + BLOCK_LABEL_INFIX + block.key.substr(block.key.rfind(' ') + 1);
+        if (first.find(label + ":\n") != 0) codeBuffer.replace(block.firstAddress, label + ":\n" + first);
+        return label;
+    }
+
+    //the last address before [address] in the function that has an instruction, or -1
+    static int previousInstruction(int address, int start) {
+        for (address--; address >= start; address--) {
+            if (isInstruction(CodeBuffer::instance().getCommand(address))) return address;
+        }
+        return -1;
+    }
+
+    static void appendJump(int address, const string &label) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        codeBuffer.replace(address, codeBuffer.getCommand(address) + "\nj " + label);
+    }
+
+    /**
+     * moves the blocks of the function that never ran to the end of the cold code. the blocks that fell
+     * through into a moved block, or out of it, jump there instead.
+     */
+    void layoutFunction(int function, vector<string> &coldCode) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        const string &name = functions[function].first;
+        vector<CounterPoint> points = findCounterPoints(function);
+        vector<CounterPoint> blocks;
+        for (int i = 0; i < points.size(); i++) {
+            if (points[i].key.find("block ") == 0) blocks.push_back(points[i]);
+        }
+        map<string, int>::iterator profiled = blocksCounts.find(name);
+        if (profiled == blocksCounts.end() || profiled->second != blocks.size()) {
+            skippedCount++;
+            return;
+        }
+        if (blocks.empty() || counts[blocks[0].key] == 0) return;
+        laidOutCount++;
+        int end = functionEnd(function);
+        vector<int> moved;
+        for (int i = 1; i < blocks.size(); i++) {
+            if (counts[blocks[i].key] != 0) continue;
+            int blockEnd = i + 1 < blocks.size() ? blocks[i + 1].firstAddress : end;
+            int last = previousInstruction(blockEnd, blocks[i].firstAddress);
+            //the last block has nothing to jump to if it falls through
+            if (last == -1 || (blockEnd == end && !isLeaving(lastCommand(codeBuffer.getCommand(last))))) continue;
+            moved.push_back(i);
+        }
+        for (int j = 0; j < moved.size(); j++) {
+            int i = moved[j];
+            int blockEnd = i + 1 < blocks.size() ? blocks[i + 1].firstAddress : end;
+            int before = previousInstruction(blocks[i].firstAddress, functions[function].second);
+            if (before != -1 && !isLeaving(lastCommand(codeBuffer.getCommand(before)))) {
+                appendJump(before, blockLabel(function, blocks[i]));
+            }
+            int last = previousInstruction(blockEnd, blocks[i].firstAddress);
+            if (!isLeaving(lastCommand(codeBuffer.getCommand(last)))) {
+                appendJump(last, blockLabel(function, blocks[i + 1]));
+            }
+        }
+        for (int j = 0; j < moved.size(); j++) {
+            int i = moved[j];
+            int blockEnd = i + 1 < blocks.size() ? blocks[i + 1].firstAddress : end;
+            coldCode.push_back("#cold block " + AssemblerCoder::to_string(i) + " of function " + name);
+            for (int address = blocks[i].firstAddress; address < blockEnd; address++) {
+                vector<string> parts = splitLines(codeBuffer.getCommand(address));
+                coldCode.insert(coldCode.end(), parts.begin(), parts.end());
+                codeBuffer.replace(address, "");
+            }
+            movedCount++;
+        }
+    }
+
+    //the next command after [index] that is not removed and is not a comment, or commands.size()
+    static int nextCommand(const vector<Command> &commands, int index) {
+        for (index++; index < commands.size(); index++) {
+            if (!commands[index].isRemoved && commands[index].text[0] != '#') return index;
+        }
+        return index;
+    }
+
+    //true if the labels that follow [index] have [label]
+    static bool isLabelNext(const vector<Command> &commands, int index, const string &label) {
+        for (int i = nextCommand(commands, index); i < commands.size(); i = nextCommand(commands, i)) {
+            const string &text = commands[i].text;
+            if (text[text.size() - 1] != ':') return false;
+            if (text == label + ":") return true;
+        }
+        return false;
+    }
+
+    /**
+     * removes the jumps to the code that follows them, and inverts the branches over a jump, after the blocks
+     * were moved. the labels are compared by name, they are not at their addresses anymore.
+     */
+    void removeJumpsToNext(int start, int end) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        vector<Command> commands;
+        for (int address = start; address < end; address++) {
+            vector<string> parts = splitLines(codeBuffer.getCommand(address));
+            for (int i = 0; i < parts.size(); i++) commands.push_back(Command(address, parts[i]));
+        }
+        bool isChanged = true;
+        while (isChanged) {
+            isChanged = false;
+            for (int i = 0; i < commands.size(); i++) {
+                if (commands[i].isRemoved) continue;
+                const string &text = commands[i].text;
+                if (opcodeOf(text) == "j" && isLabelNext(commands, i, targetOf(text))) {
+                    commands[i].isRemoved = true;
+                    isChanged = true;
+                    continue;
+                }
+                int next = nextCommand(commands, i);
+                if (!isBranch(text) || next == commands.size() || opcodeOf(commands[next].text) != "j") continue;
+                string inverted = AssemblerCoder::invertBranch(text, targetOf(commands[next].text));
+                if (inverted != "" && isLabelNext(commands, next, targetOf(text))) {
+                    commands[i].text = inverted;
+                    commands[next].isRemoved = true;
+                    isChanged = true;
+                }
+            }
+        }
+        map<int, string> lines;
+        for (int i = 0; i < commands.size(); i++) {
+            if (commands[i].isRemoved) continue;
+            string &line = lines[commands[i].address];
+            line += (line == "" ? "" : "\n") + commands[i].text;
+        }
+        for (int address = start; address < end; address++) {
+            string line = lines.count(address) ? lines[address] : "";
+            if (line != codeBuffer.getCommand(address)) codeBuffer.replace(address, line);
+        }
+    }
+
+public:
+    static Profile &getInstance() {
+        static Profile INSTANCE;
+        return INSTANCE;
+    }
+
+    void setInstrumenting() {
+        isInstrumentingCode = true;
+    }
+
+    bool isInstrumenting() const {
+        return isInstrumentingCode;
+    }
+
+    bool isLoaded() const {
+        return isProfileLoaded;
+    }
+
+    /**
+     * reads the counts an instrumented program printed. returns false if the file has none.
+     */
+    bool load(const string &path) {
+        ifstream file(path.c_str());
+        if (!file) return false;
+        stringstream text;
+        text << file.rdbuf();
+        string output = text.str();
+        size_t found = output.find(PROFILE_HEADER "\n");
+        if (found == string::npos) return false;
+        stringstream lines(output.substr(found + string(PROFILE_HEADER "\n").size()));
+        string line;
+        while (getline(lines, line)) {
+            stringstream words(line);
+            string kind, function, name;
+            long long count;
+            if (!(words >> kind >> function >> name >> count) || (kind != "block" && kind != "call")) continue;
+            counts[kind + " " + function + " " + name] += count;
+            if (kind == "block") blocksCounts[function]++;
+        }
+        isProfileLoaded = true;
+        return true;
+    }
+
+    /**
+     * the most commands a function may have to be inlined. a function that was never called is not inlined,
+     * returns 0, and one that was called often may be bigger than [maxCommands].
+     */
+    int inlineLimit(const string &function, int maxCommands) {
+        if (!isProfileLoaded) return maxCommands;
+        bool isProfiled = false;
+        long long calls = 0;
+        for (map<string, long long>::iterator it = counts.begin(); it != counts.end(); ++it) {
+            if (it->first.find("call ") != 0 || it->first.substr(it->first.rfind(' ') + 1) != function) continue;
+            isProfiled = true;
+            calls += it->second;
+        }
+        if (!isProfiled) return maxCommands;
+        if (calls == 0) {
+            coldCallsCount++;
+            return 0;
+        }
+        if (calls >= HOT_CALLS) {
+            hotCallsCount++;
+            return 2 * maxCommands;
+        }
+        return maxCommands;
+    }
+
+    /**
+     * adds the counters to the functions' code, whose labels are at [functionStarts], and the routine that
+     * prints them. the code after the last function's label is its own.
+     */
+    void instrumentProgram(const vector<pair<string, int> > &functionStarts) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        functions = functionStarts;
+        findLabels(codeBuffer.nextAddress());
+        vector<string> keys;
+        for (int function = 0; function < functions.size(); function++) {
+            vector<CounterPoint> points = findCounterPoints(function);
+            //from the last, a command with two counters gets them in order
+            for (int i = points.size() - 1; i >= 0; i--) {
+                codeBuffer.replace(points[i].address, counterCode(keys.size() + i) + "\n"
+                                                      + codeBuffer.getCommand(points[i].address));
+            }
+            for (int i = 0; i < points.size(); i++) {
+                keys.push_back(points[i].key);
+                (points[i].key.find("block ") == 0 ? blocksCount : callsCount)++;
+            }
+        }
+        int keySize = 0;
+        for (int i = 0; i < keys.size(); i++) keySize = max(keySize, (int) keys[i].size() + 2);
+        string words = "0";
+        for (int i = 1; i < keys.size(); i++) words += ", 0";
+        codeBuffer.emitData(string(PROFILE_COUNTS_LABEL) + ": .word " + words);
+        for (int i = 0; i < keys.size(); i++) {
+            //the keys are padded to one size, the printing finds them by it
+            codeBuffer.emitData(PROFILE_KEY_LABEL_PREFIX + AssemblerCoder::to_string(i) + ": .asciiz \"" + keys[i]
+                                + string(keySize - 1 - keys[i].size(), ' ') + "\"");
+        }
+        emitDump(keys, keySize);
+    }
+
+    /**
+     * moves the blocks that never ran to the end of the program, by the loaded profile.
+     */
+    void layoutProgram(const vector<pair<string, int> > &functionStarts) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        if (functionStarts.empty()) return;
+        functions = functionStarts;
+        findLabels(codeBuffer.nextAddress());
+        vector<string> coldCode;
+        for (int function = 0; function < functions.size(); function++) layoutFunction(function, coldCode);
+        for (int i = 0; i < coldCode.size(); i++) codeBuffer.emit(coldCode[i]);
+        removeJumpsToNext(functions[0].second, codeBuffer.nextAddress());
+    }
+
+    void printReport(ostream &out) {
+        if (isInstrumentingCode) {
+            out << "counted " << blocksCount << " blocks and " << callsCount << " calls" << endl;
+        }
+        if (isProfileLoaded) {
+            out << "laid out " << laidOutCount << " functions by the profile, skipped " << skippedCount
+                << " that changed since, moved " << movedCount << " cold blocks, did not inline " << coldCallsCount
+                << " functions that were never called and allowed " << hotCallsCount << " hot ones to be bigger"
+                << endl;
+        }
+    }
+};
+
+#endif //HW3_PROFILE_HPP
@@ -0,0 +1,209 @@
+#ifndef HW3_RANGE_ANALYSIS_HPP
+#define HW3_RANGE_ANALYSIS_HPP
+#define INT_MIN_VALUE (-2147483648LL)
+#define INT_MAX_VALUE (2147483647LL)
+#define BYTE_MAX_VALUE (255LL)
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include "bp.hpp"
+extern int yylineno;
+
+using namespace std;
+
+/**
+ * a fact about a variable that was used at [useAddress], it holds from [factAddress] on
+ * as long as the variable is not assigned.
+ */
+struct Reason {
+    string name;
+    int factAddress;
+    int useAddress;
+
+    Reason(string _name, int _factAddress, int _useAddress)
+            : name(_name), factAddress(_factAddress), useAddress(_useAddress) {}
+};
+
+/**
+ * the values an expression may have, and the facts about variables this knowledge relies on.
+ */
+struct ValueRange {
+    long long low;
+    long long high;
+    bool isNonZero;
+    vector<Reason> reasons;
+
+    ValueRange(long long _low, long long _high) : low(_low), high(_high), isNonZero(false), reasons() {}
+
+    bool excludesZero() const {
+        return isNonZero || low > 0 || high < 0;
+    }
+
+    bool isWithin(long long min, long long max) const {
+        return min <= low && high <= max;
+    }
+
+    void addReasons(const ValueRange &other) {
+        reasons.insert(reasons.end(), other.reasons.begin(), other.reasons.end());
+    }
+};
+
+/**
+ * the values a variable holds from [address] on, learned from a condition or an assignment.
+ */
+struct VariableFact {
+    string name;
+    ValueRange range;
+    int address;
+
+    VariableFact(string _name, const ValueRange &_range)
+            : name(_name), range(_range), address(CodeBuffer::instance().nextAddress()) {}
+};
+
+/**
+ * removes the byte masks, the division by zero checks and the precondition checks that the value ranges
+ * prove redundant.
+ * a single pass does not know yet if a loop around the check assigns the variables its proof relies on,
+ * so such checks are removed only at the end of the function.
+ */
+class RangeAnalysis {
+private:
+    struct Check {
+        int address;
+        int line;
+        string description;
+        vector<Reason> reasons;
+        string target; //a call is kept and jumps to [newTarget] instead of [target], that checks
+        string newTarget;
+
+        Check(int _address, string _description, const vector<Reason> &_reasons, string _target, string _newTarget)
+                : address(_address), line(yylineno), description(_description), reasons(_reasons), target(_target),
+                  newTarget(_newTarget) {}
+    };
+
+    vector<Check> pendingChecks;
+    vector<pair<int, int> > loops; //the first and the last address of every loop in the function
+    vector<pair<string, int> > assignments;
+    vector<string> report;
+    int checksCount;
+    int removedCount;
+
+    RangeAnalysis() : pendingChecks(), loops(), assignments(), report(), checksCount(0), removedCount(0) {}
+
+    static string to_string(int num) {
+        stringstream ss;
+        ss << num;
+        return ss.str();
+    }
+
+    void remove(const Check &check) {
+        CodeBuffer &codeBuffer = CodeBuffer::instance();
+        if (check.target == "") {
+            codeBuffer.replace(check.address, "");
+        } else {
+            //the call may have become a tail call since, the jump ends the command
+            string command = codeBuffer.getCommand(check.address);
+            string jump = " " + check.target;
+            if (command.size() < jump.size() || command.compare(command.size() - jump.size(), jump.size(), jump) != 0) {
+                return;
+            }
+            codeBuffer.replace(check.address, command.substr(0, command.size() - check.target.size()) + check.newTarget);
+        }
+        removedCount++;
+        report.push_back("line " + to_string(check.line) + ": removed " + check.description);
+    }
+
+    /**
+     * returns the variable of the reason that a loop assigns after the fact was learned, or "".
+     */
+    string findBrokenReason(const Check &check) {
+        for (int i = 0; i < check.reasons.size(); i++) {
+            const Reason &reason = check.reasons[i];
+            for (int j = 0; j < loops.size(); j++) {
+                int start = loops[j].first, end = loops[j].second;
+                //a loop that started before the fact was learned learns it again on every iteration
+                if (start <= reason.factAddress || reason.useAddress < start || end < reason.useAddress) continue;
+                for (int k = 0; k < assignments.size(); k++) {
+                    if (assignments[k].first == reason.name && start <= assignments[k].second
+                        && assignments[k].second <= end) {
+                        return reason.name;
+                    }
+                }
+            }
+        }
+        return "";
+    }
+
+public:
+    static RangeAnalysis &getInstance() {
+        static RangeAnalysis INSTANCE;
+        return INSTANCE;
+    }
+
+    /**
+     * records the check emitted at [address], it is removed if [isRedundant].
+     * a check in another function is skipped by a call at [address] jumping to [newTarget] instead of [target].
+     */
+    void addCheck(int address, string description, bool isRedundant, const vector<Reason> &reasons,
+                  string target = "", string newTarget = "") {
+        checksCount++;
+        if (!isRedundant) return;
+        Check check(address, description, reasons, target, newTarget);
+        if (reasons.empty()) {
+            remove(check);
+        } else {
+            pendingChecks.push_back(check);
+        }
+    }
+
+    void addLoop(int start, int end) {
+        loops.push_back(make_pair(start, end));
+    }
+
+    void addAssignment(string name) {
+        assignments.push_back(make_pair(name, CodeBuffer::instance().nextAddress()));
+    }
+
+    /**
+     * the number of assignments to the variable in [start, end).
+     */
+    int countAssignments(const string &name, int start, int end) {
+        int count = 0;
+        for (int i = 0; i < assignments.size(); i++) {
+            if (assignments[i].first == name && start <= assignments[i].second && assignments[i].second < end) count++;
+        }
+        return count;
+    }
+
+    void startFunction() {
+        pendingChecks.clear();
+        loops.clear();
+        assignments.clear();
+    }
+
+    /**
+     * removes the pending checks whose reasons were not broken by a loop.
+     */
+    void endFunction() {
+        for (int i = 0; i < pendingChecks.size(); i++) {
+            string brokenReason = findBrokenReason(pendingChecks[i]);
+            if (brokenReason == "") {
+                remove(pendingChecks[i]);
+            } else {
+                report.push_back("line " + to_string(pendingChecks[i].line) + ": kept " +
+                                 pendingChecks[i].description + ", " + brokenReason + " is assigned in a loop");
+            }
+        }
+        pendingChecks.clear();
+    }
+
+    void printReport(ostream &out) {
+        for (int i = 0; i < report.size(); i++) {
+            out << report[i] << endl;
+        }
+        out << "removed " << removedCount << " of " << checksCount << " checks" << endl;
+    }
+};
+
+#endif //HW3_RANGE_ANALYSIS_HPP
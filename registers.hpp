@@ -5,27 +5,35 @@
 #define TEMP_REG_START (0)
 #define STORED_REG_START TEMP_REG_END
 #define STORED_REG_END NUMBER_OF_REG
+#define ARGUMENT_REG_NUM (4) //arguments are passed in $a0-$a3, the rest in the stack
 #include <string>
+#include <map>
 extern int yylineno;
 
 using namespace std;
 class Registers{
 private:
     bool bitmap[NUMBER_OF_REG];
+    bool homes[NUMBER_OF_REG]; //registers that hold a variable until its scope ends
+    bool touched[NUMBER_OF_REG]; //registers that were allocated since the current function started
     string names[NUMBER_OF_REG];
     static string to_string(int num){
         stringstream ss;
         ss<< num;
         return ss.str();
     }
-    Registers():bitmap(),names(){
+    Registers():bitmap(),homes(),touched(),names(){
         for(int i=TEMP_REG_START;i<TEMP_REG_END;i++) {
             names[i] = "$t" + to_string(i);
             bitmap[i]=false;
+            homes[i]=false;
+            touched[i]=false;
         }
         for(int i=STORED_REG_START;i<STORED_REG_END;i++){
             names[i] = "$s" + to_string(i-STORED_REG_START);
             bitmap[i]=false;
+            homes[i]=false;
+            touched[i]=false;
         }
     }
 
@@ -39,6 +47,10 @@ private:
     }
 
 public:
+    static string argumentRegister(int argumentIndex){
+        return "$a" + to_string(argumentIndex);
+    }
+
     static Registers& getInstance(){
         static Registers INSTANCE;
         return INSTANCE;
@@ -56,6 +68,68 @@ public:
 
 
 
+    /**
+     * the temporary registers that hold no value.
+     */
+    vector<string> getFreeTempRegisters(){
+        vector<string> free;
+        for(int i=TEMP_REG_START;i<TEMP_REG_END;i++) {
+            if(!bitmap[i]){
+                free.push_back(names[i]);
+            }
+        }
+        return free;
+    }
+
+    /**
+     * replaces each register of the command that has a substitute by it, like the temporaries of inlined code.
+     */
+    static string rename(const string &command, map<string, string> &substitutes){
+        string renamed;
+        for (int i = 0; i < command.size(); i++) {
+            string reg = command.substr(i, 3);
+            if (substitutes.count(reg)) {
+                renamed += substitutes[reg];
+                i += 2;
+            } else {
+                renamed += command[i];
+            }
+        }
+        return renamed;
+    }
+
+    /**
+     * the temporary registers are caller saved - a caller saves the ones that hold a value during the call.
+     */
+    vector<string> getUsedTempRegisters(){
+        vector<string> used;
+        for(int i=TEMP_REG_START;i<TEMP_REG_END;i++) {
+            if(bitmap[i]){
+                used.push_back(names[i]);
+            }
+        }
+        return used;
+    }
+
+    /**
+     * the stored registers are callee saved - a function saves the ones it uses.
+     */
+    vector<string> getTouchedStoredRegisters(){
+        vector<string> used;
+        for(int i=STORED_REG_START;i<STORED_REG_END;i++) {
+            if(touched[i]){
+                used.push_back(names[i]);
+            }
+        }
+        return used;
+    }
+
+    void startFunction(){
+        for(int i=0;i<NUMBER_OF_REG;i++) {
+            touched[i]=false;
+        }
+    }
+
     void markAsUsed(string reg){
         int index = nameToIndex(reg);
         bitmap[index] = true;
@@ -66,6 +140,7 @@ public:
         for(int i=0;i<NUMBER_OF_REG;i++){
             if(!bitmap[i]){
                 bitmap[i]=true;
+                touched[i]=true;
                 return names[i];
             }
         }
@@ -75,10 +150,50 @@ public:
 
     Registers& regFree(string& name){
         for(int i=0;i<NUMBER_OF_REG;i++){
-            if(names[i]==name)
+            if(names[i]==name && !homes[i])
                 bitmap[i]= false;
         }
         //name="";
+        return *this;
+    }
+
+    /**
+     * allocates a register that keeps a variable for its whole scope.
+     * variables are kept in the stored registers, "" is returned when none of them is free
+     * and the variable should live in the stack.
+     */
+    string homeAlloc(){
+        for(int i=STORED_REG_START;i<STORED_REG_END;i++){
+            if(!bitmap[i]){
+                bitmap[i]=true;
+                homes[i]=true;
+                touched[i]=true;
+                return names[i];
+            }
+        }
+        return "";
+    }
+
+    /**
+     * allocates the given temporary until homeFree, like the register of a variable.
+     */
+    void reserve(const string &name){
+        int index = nameToIndex(name);
+        bitmap[index] = true;
+        homes[index] = true;
+    }
+
+    void homeFree(string& name){
+        int index = nameToIndex(name);
+        bitmap[index] = false;
+        homes[index] = false;
+    }
+
+    bool isHome(string& name){
+        for(int i=0;i<NUMBER_OF_REG;i++){
+            if(names[i]==name) return homes[i];
+        }
+        return false;
     }
 
 };
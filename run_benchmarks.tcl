@@ -0,0 +1,124 @@
+#!/bin/tclsh
+
+# runs the programs of tests/bench in the built-in simulator at every optimization level, checks their output
+# and compares their code size, instructions and cycles to tests/bench/baseline.txt.
+# a count that grew by more than the threshold is a regression.
+# "run_benchmarks.tcl update" writes the counts of this run as the new baseline.
+
+set threshold 0.02
+set baseline_file tests/bench/baseline.txt
+set levels {
+	full {}
+	no-unroll {--unroll=1}
+	no-dataflow {--no-constant-propagation --no-value-numbering --no-dead-code-elimination}
+	minimal {--unroll=1 --no-constant-propagation --no-value-numbering --no-dead-code-elimination}
+}
+
+proc comp_file {file1 file2} {
+    # optimization: check file size first
+    set equal 0
+    if {[file size $file1] == [file size $file2]} {
+        set fh1 [open $file1 r]
+        set fh2 [open $file2 r]
+        set equal [string equal [read $fh1] [read $fh2]]
+        close $fh1
+        close $fh2
+    }
+    return $equal
+}
+
+proc report_count {report name} {
+	if {[regexp "$name: (\[0-9\]+)" $report -> count]} {
+		return $count
+	}
+	return -1
+}
+
+proc change {old new} {
+	if {$old <= 0} {
+		return "     "
+	}
+	return [format "%+5.1f%%" [expr {100.0 * ($new - $old) / $old}]]
+}
+
+set baseline [dict create]
+if {[file exists $baseline_file]} {
+	set fh [open $baseline_file r]
+	foreach line [split [read $fh] "\n"] {
+		if {[llength $line] == 5} {
+			dict set baseline "[lindex $line 0] [lindex $line 1]" [lrange $line 2 4]
+		}
+	}
+	close $fh
+}
+
+exec make
+set bench_files [lsort [glob tests/bench/*.in]]
+set failed_tests ""
+set regressions ""
+set results ""
+puts [format "%-16s %-12s %11s %6s %11s %6s %11s %6s" program level "code size" "" instructions "" cycles ""]
+foreach file $bench_files {
+	set name [file rootname [file tail $file]]
+	set out_file [file rootname $file].out
+	set res_file [file rootname $file].res
+	set report_file [file rootname $file].report
+	foreach {level flags} $levels {
+		if {[catch {exec ./hw5 {*}$flags --run < $file > $res_file 2> $report_file}]} {
+			lappend failed_tests "$name $level"
+			continue
+		}
+		if {![comp_file $out_file $res_file]} {
+			lappend failed_tests "$name $level"
+			continue
+		}
+		set fh [open $report_file r]
+		set report [read $fh]
+		close $fh
+		set counts [list [report_count $report "code size"] [report_count $report instructions] \
+		                 [report_count $report cycles]]
+		lappend results "$name $level $counts"
+		set old {-1 -1 -1}
+		if {[dict exists $baseline "$name $level"]} {
+			set old [dict get $baseline "$name $level"]
+		}
+		set line [format "%-16s %-12s" $name $level]
+		foreach count $counts old_count $old {
+			append line [format " %11d %s" $count [change $old_count $count]]
+			if {$old_count > 0 && $count > $old_count * (1 + $threshold)} {
+				lappend regressions "$name $level"
+			}
+		}
+		puts $line
+		file delete $res_file
+		file delete $report_file
+	}
+}
+
+if {[lindex $argv 0] eq "update"} {
+	set fh [open $baseline_file w]
+	puts $fh [join $results "\n"]
+	close $fh
+	puts "wrote the baseline to $baseline_file"
+}
+if {$failed_tests ne ""} {
+	puts "############################################################"
+	puts "################### Failed #################################"
+	puts "############################################################"
+	puts "The output of the following programs was wrong or they crashed:"
+	foreach test $failed_tests {
+		puts $test
+	}
+}
+if {$regressions ne ""} {
+	puts "The following programs got slower or bigger by more than [expr {$threshold * 100}]%:"
+	foreach test [lsort -unique $regressions] {
+		puts $test
+	}
+}
+if {$failed_tests ne "" || $regressions ne ""} {
+	exit 1
+}
+puts "############################################################"
+puts "################### ALL CLEAN ##############################"
+puts "############################################################"
@@ -0,0 +1,95 @@
+#!/bin/tclsh
+
+# compiles the programs of tests/regression with every optimization on, and with each of the passes that
+# rewrite the emitted code turned off, runs them in spim and checks their output against the .out files.
+# a .dead file holds one regular expression per line for code that dead code elimination removes, and a
+# .redundant file for code that value numbering removes. none of them may match the compiled program while
+# the pass is on.
+
+set levels {
+	full {}
+	no-value-numbering {--no-value-numbering}
+	no-constant-propagation {--no-constant-propagation}
+	no-dead-code-elimination {--no-dead-code-elimination}
+	minimal {--unroll=1 --no-constant-propagation --no-value-numbering --no-dead-code-elimination}
+}
+
+# the file of the patterns of each pass, and the flag that turns it off
+set removing_passes {
+	.dead --no-dead-code-elimination
+	.redundant --no-value-numbering
+}
+
+proc has_removed_code {asm_file patterns_file} {
+	set fh [open $asm_file r]
+	set asm [read $fh]
+	close $fh
+	set fh [open $patterns_file r]
+	set patterns [split [string trim [read $fh]] "\n"]
+	close $fh
+	foreach pattern $patterns {
+		if {[regexp -- $pattern $asm]} {
+			return 1
+		}
+	}
+	return 0
+}
+
+proc comp_file {file1 file2} {
+    # optimization: check file size first
+    set equal 0
+    if {[file size $file1] == [file size $file2]} {
+        set fh1 [open $file1 r]
+        set fh2 [open $file2 r]
+        set equal [string equal [read $fh1] [read $fh2]]
+        close $fh1
+        close $fh2
+    }
+    return $equal
+}
+
+exec make
+set test_files [lsort [glob tests/regression/*.in]]
+set failed_tests ""
+foreach file $test_files {
+	set out_file [file rootname $file].out
+	set asm_file [file rootname $file].asm
+	set res_file [file rootname $file].res
+	foreach {level flags} $levels {
+		if {[catch {exec ./hw5 {*}$flags < $file > $asm_file}] || [catch {exec ./spim -file $asm_file > $res_file}]} {
+			lappend failed_tests "$file $level"
+			continue
+		}
+		set is_kept 0
+		foreach {extension off_flag} $removing_passes {
+			set patterns_file [file rootname $file]$extension
+			if {[file exists $patterns_file] && [lsearch $flags $off_flag] == -1
+			    && [has_removed_code $asm_file $patterns_file]} {
+				set is_kept 1
+			}
+		}
+		if {$is_kept} {
+			lappend failed_tests "$file $level"
+			continue
+		}
+		if {![comp_file $out_file $res_file]} {
+			lappend failed_tests "$file $level"
+			continue
+		}
+		file delete $asm_file $res_file
+	}
+}
+
+if {$failed_tests ne ""} {
+	puts "############################################################"
+	puts "################### Failed #################################"
+	puts "############################################################"
+	puts "The output of the following programs was wrong, they kept code that is removed or they crashed:"
+	foreach test $failed_tests {
+		puts $test
+	}
+	exit 1
+}
+puts "############################################################"
+puts "################### ALL CLEAN ##############################"
+puts "############################################################"
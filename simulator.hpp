@@ -0,0 +1,645 @@
+#ifndef HW3_SIMULATOR_HPP
+#define HW3_SIMULATOR_HPP
+#define TEXT_BASE (0x00400000u)
+#define DATA_BASE (0x10010000u)
+#define STACK_TOP (0x7ffffffcu) //the first $sp, the stack grows down from it
+#define STACK_MAX_BYTES (64u * 1024 * 1024)
+#define RETURN_TO_EXIT (0u) //the $ra main starts with, returning to it ends the program
+#define MUL_EXTRA_CYCLES (4) //the cycles an instruction takes after its first, a rough model of a simple pipeline
+#define DIV_EXTRA_CYCLES (34)
+#define TAKEN_EXTRA_CYCLES (1)
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace std;
+
+/**
+ * runs the MIPS code the compiler emits, without an external simulator, and counts what it does.
+ * the program is assembled from its text: every instruction is decoded once into its operation, registers and
+ * immediate, and a jump's label into the index of the instruction it jumps to. the simulation then only
+ * counts the runs of every instruction, the opcodes and the functions are summed from those counts at the end.
+ * only the subset the compiler emits is supported, with the syscalls print_int, print_string and exit.
+ */
+class Simulator {
+public:
+    enum Operation {
+        LI, LA, MOVE, ADDU, SUBU, MUL, DIV, MULT, MFHI, MFLO, AND, OR, XOR, NOR, SLT, SLTU, SLL, SRL, SRA,
+        LW, SW, BEQ, BNE, BLT, BLE, BGT, BGE, J, JAL, JR, SYSCALL, NOP
+    };
+
+    struct Instruction {
+        Operation operation;
+        string opcode;
+        int destination;
+        int source;
+        int second; //-1 if the second source is the immediate
+        int immediate;
+        int target; //the instruction a jump goes to
+        int line;
+
+        Instruction() : operation(NOP), opcode(), destination(0), source(0), second(-1), immediate(0), target(-1),
+                        line(0) {}
+    };
+
+private:
+    //a call that has not returned yet
+    struct Frame {
+        int function;
+        unsigned int returnAddress;
+
+        Frame(int _function, unsigned int _returnAddress) : function(_function), returnAddress(_returnAddress) {}
+    };
+
+    vector<Instruction> code;
+    map<string, int> codeLabels;
+    map<string, unsigned int> dataLabels;
+    vector<unsigned char> data;
+    vector<unsigned char> stack; //stack[i] is the byte at STACK_TOP + 3 - i
+    vector<string> functions;
+    vector<int> owners; //the function every instruction belongs to, the last one whose label is before it
+    int registers[32];
+    int hi;
+    int lo;
+    string error;
+
+    vector<long long> runs; //the times every instruction ran
+    long long executed;
+    long long takenBranches;
+    long long branches;
+    unsigned int lowestStack;
+    vector<long long> inclusive;
+    vector<int> active; //the calls of every function that have not returned yet
+    vector<long long> activeSince;
+    vector<Frame> frames;
+
+    static int registerIndex(const string &name) {
+        static const char *names[] = {"$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1",
+                                      "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$s0", "$s1", "$s2", "$s3", "$s4",
+                                      "$s5", "$s6", "$s7", "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"};
+        if (name == "$0") return 0;
+        for (int i = 0; i < 32; i++) {
+            if (name == names[i]) return i;
+        }
+        if (name.size() > 1 && name[0] == '$' && name.find_first_not_of("0123456789", 1) == string::npos) {
+            int index = atoi(name.c_str() + 1);
+            if (index < 32) return index;
+        }
+        return -1;
+    }
+
+    static bool isNumber(const string &text) {
+        return text != "" && text.find_first_not_of("-0123456789", text[0] == '-' ? 1 : 0) == string::npos
+               && text != "-";
+    }
+
+    static vector<string> splitOperands(const string &text) {
+        vector<string> operands;
+        stringstream ss(text);
+        string operand;
+        while (getline(ss, operand, ',')) {
+            size_t first = operand.find_first_not_of(" \t"), last = operand.find_last_not_of(" \t");
+            if (first != string::npos) operands.push_back(operand.substr(first, last - first + 1));
+        }
+        return operands;
+    }
+
+    static string unescape(const string &text) {
+        string bytes;
+        for (int i = 0; i < text.size(); i++) {
+            if (text[i] != '\\' || i + 1 == text.size()) {
+                bytes += text[i];
+                continue;
+            }
+            char escaped = text[++i];
+            if (escaped == 'n') escaped = '\n';
+            if (escaped == 't') escaped = '\t';
+            if (escaped == 'r') escaped = '\r';
+            if (escaped == '0') escaped = '\0';
+            bytes += escaped;
+        }
+        return bytes;
+    }
+
+    bool fail(int line, const string &message) {
+        if (error == "") error = "line " + toString(line) + ": " + message;
+        return false;
+    }
+
+    static string toString(long long num) {
+        stringstream ss;
+        ss << num;
+        return ss.str();
+    }
+
+    bool parseData(const string &line, int lineNumber) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) return fail(lineNumber, "a data line without a label");
+        dataLabels[line.substr(0, colon)] = DATA_BASE + data.size();
+        string rest = line.substr(colon + 1);
+        size_t first = rest.find_first_not_of(" \t");
+        if (first == string::npos) return true;
+        rest = rest.substr(first);
+        size_t space = rest.find_first_of(" \t");
+        string directive = rest.substr(0, space);
+        string value = space == string::npos ? "" : rest.substr(space + 1);
+        if (directive == ".ascii" || directive == ".asciiz") {
+            size_t open = value.find('"'), close = value.rfind('"');
+            if (open == string::npos || close == open) return fail(lineNumber, "a string without quotes");
+            string bytes = unescape(value.substr(open + 1, close - open - 1));
+            data.insert(data.end(), bytes.begin(), bytes.end());
+            if (directive == ".asciiz") data.push_back(0);
+        } else if (directive == ".word") {
+            while (data.size() % 4 != 0) data.push_back(0);
+            dataLabels[line.substr(0, colon)] = DATA_BASE + data.size();
+            vector<string> words = splitOperands(value);
+            for (int i = 0; i < words.size(); i++) {
+                unsigned int word = (unsigned int) atoll(words[i].c_str());
+                for (int j = 0; j < 4; j++) data.push_back((word >> (8 * j)) & 0xff);
+            }
+        } else if (directive == ".space") {
+            data.resize(data.size() + atoi(value.c_str()), 0);
+        } else {
+            return fail(lineNumber, "unsupported directive " + directive);
+        }
+        return true;
+    }
+
+    bool parseRegister(const string &operand, int &reg, int lineNumber) {
+        reg = registerIndex(operand);
+        return reg != -1 || fail(lineNumber, "bad register " + operand);
+    }
+
+    //the register or the immediate of a second source
+    bool parseSecond(const string &operand, Instruction &instruction, int lineNumber) {
+        if (isNumber(operand)) {
+            instruction.second = -1;
+            instruction.immediate = (int) atoll(operand.c_str());
+            return true;
+        }
+        return parseRegister(operand, instruction.second, lineNumber);
+    }
+
+    bool parseInstruction(const string &line, int lineNumber, vector<string> &targets) {
+        static const string names[] = {"li", "la", "move", "addu", "subu", "mul", "div", "mult", "mfhi", "mflo",
+                                       "and", "or", "xor", "nor", "slt", "sltu", "sll", "srl", "sra", "lw", "sw",
+                                       "beq", "bne", "blt", "ble", "bgt", "bge", "j", "jal", "jr", "syscall",
+                                       "nop"};
+        size_t space = line.find_first_of(" \t");
+        Instruction instruction;
+        instruction.opcode = line.substr(0, space);
+        instruction.line = lineNumber;
+        vector<string> operands = splitOperands(space == string::npos ? "" : line.substr(space + 1));
+        string opcode = instruction.opcode;
+        //the immediate forms do the same
+        if (opcode == "addiu" || opcode == "addi" || opcode == "add") opcode = "addu";
+        if (opcode == "sub") opcode = "subu";
+        if (opcode == "andi") opcode = "and";
+        if (opcode == "ori") opcode = "or";
+        if (opcode == "xori") opcode = "xor";
+        if (opcode == "slti") opcode = "slt";
+        if (opcode == "sltiu") opcode = "sltu";
+        int operation = -1;
+        for (int i = 0; i <= NOP; i++) {
+            if (opcode == names[i]) operation = i;
+        }
+        if (operation == -1) return fail(lineNumber, "unsupported instruction " + instruction.opcode);
+        instruction.operation = (Operation) operation;
+        string target;
+        bool isParsed = true;
+        switch (instruction.operation) {
+            case SYSCALL:
+            case NOP:
+                break;
+            case J:
+            case JAL:
+                if (operands.size() != 1) return fail(lineNumber, "bad operands");
+                target = operands[0];
+                break;
+            case JR:
+                if (operands.size() != 1) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.source, lineNumber);
+                break;
+            case MFHI:
+            case MFLO:
+                if (operands.size() != 1) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.destination, lineNumber);
+                break;
+            case LI:
+            case LA:
+                if (operands.size() != 2) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.destination, lineNumber);
+                if (instruction.operation == LI) {
+                    instruction.immediate = (int) atoll(operands[1].c_str());
+                } else {
+                    target = operands[1];
+                }
+                break;
+            case MOVE:
+                if (operands.size() != 2) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.destination, lineNumber)
+                           && parseRegister(operands[1], instruction.source, lineNumber);
+                break;
+            case MULT:
+                if (operands.size() != 2) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.source, lineNumber)
+                           && parseSecond(operands[1], instruction, lineNumber);
+                break;
+            case LW:
+            case SW: {
+                if (operands.size() != 2) return fail(lineNumber, "bad operands");
+                size_t open = operands[1].find('(');
+                if (open == string::npos) return fail(lineNumber, "bad address " + operands[1]);
+                instruction.immediate = atoi(operands[1].substr(0, open).c_str());
+                isParsed = parseRegister(operands[0], instruction.destination, lineNumber)
+                           && parseRegister(operands[1].substr(open + 1, operands[1].size() - open - 2),
+                                            instruction.source, lineNumber);
+                break;
+            }
+            case BEQ:
+            case BNE:
+            case BLT:
+            case BLE:
+            case BGT:
+            case BGE:
+                if (operands.size() != 3) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.source, lineNumber)
+                           && parseSecond(operands[1], instruction, lineNumber);
+                target = operands[2];
+                break;
+            default:
+                if (operands.size() != 3) return fail(lineNumber, "bad operands");
+                isParsed = parseRegister(operands[0], instruction.destination, lineNumber)
+                           && parseRegister(operands[1], instruction.source, lineNumber)
+                           && parseSecond(operands[2], instruction, lineNumber);
+        }
+        code.push_back(instruction);
+        targets.push_back(target);
+        return isParsed;
+    }
+
+public:
+    /**
+     * decodes the program into code and data without running it. returns false, with the error in getError(),
+     * if it has something the simulator does not support.
+     */
+    bool assemble(const string &program) {
+        stringstream lines(program);
+        string line;
+        bool isData = false;
+        vector<string> targets;
+        map<int, int> functionStarts;
+        int lineNumber = 0;
+        while (getline(lines, line)) {
+            lineNumber++;
+            size_t first = line.find_first_not_of(" \t");
+            if (first == string::npos || line[first] == '#') continue;
+            line = line.substr(first);
+            if (line == ".data" || line == ".text") {
+                isData = line == ".data";
+                continue;
+            }
+            if (line[0] == '.') continue;
+            if (isData) {
+                if (!parseData(line, lineNumber)) return false;
+                continue;
+            }
+            size_t colon = line.find(':');
+            if (colon != string::npos && line.find(' ') > colon) {
+                codeLabels[line.substr(0, colon)] = code.size();
+                line = line.substr(colon + 1);
+                first = line.find_first_not_of(" \t");
+                if (first == string::npos) continue;
+                line = line.substr(first);
+            }
+            if (!parseInstruction(line, lineNumber, targets)) return false;
+        }
+        for (int i = 0; i < code.size(); i++) {
+            if (targets[i] == "") continue;
+            if (code[i].operation == LA) {
+                map<string, unsigned int>::iterator found = dataLabels.find(targets[i]);
+                if (found != dataLabels.end()) {
+                    code[i].immediate = (int) found->second;
+                    continue;
+                }
+            }
+            map<string, int>::iterator found = codeLabels.find(targets[i]);
+            if (found == codeLabels.end()) return fail(code[i].line, "unknown label " + targets[i]);
+            code[i].target = found->second;
+            if (code[i].operation == LA) code[i].immediate = (int) (TEXT_BASE + 4 * found->second);
+        }
+        if (codeLabels.count("main") == 0) return fail(0, "no main");
+        owners = vector<int>(code.size(), -1);
+        for (int i = 0; i < functions.size(); i++) {
+            map<string, int>::iterator found = codeLabels.find(functions[i]);
+            if (found != codeLabels.end()) functionStarts[found->second] = i;
+        }
+        int owner = -1;
+        for (int i = 0; i < code.size(); i++) {
+            map<int, int>::iterator start = functionStarts.find(i);
+            if (start != functionStarts.end()) owner = start->second;
+            owners[i] = owner;
+        }
+        return true;
+    }
+
+    const vector<Instruction> &getCode() const {
+        return code;
+    }
+
+    const vector<unsigned char> &getData() const {
+        return data;
+    }
+
+    //the index of the instruction at the code label, or -1 if there is no such label
+    int labelIndex(const string &label) const {
+        map<string, int>::const_iterator found = codeLabels.find(label);
+        return found == codeLabels.end() ? -1 : found->second;
+    }
+
+private:
+    unsigned char *byteAt(unsigned int address, int line) {
+        if (address >= DATA_BASE && address < DATA_BASE + data.size()) return &data[address - DATA_BASE];
+        if (address <= STACK_TOP + 3 && address > STACK_TOP + 3 - STACK_MAX_BYTES) {
+            unsigned int index = STACK_TOP + 3 - address;
+            if (index >= stack.size()) stack.resize(index + 1024, 0);
+            return &stack[index];
+        }
+        fail(line, "bad address " + toString(address));
+        return NULL;
+    }
+
+    bool load(unsigned int address, int &value, int line) {
+        if (address % 4 != 0) return fail(line, "unaligned address " + toString(address));
+        unsigned int word = 0;
+        for (int i = 3; i >= 0; i--) {
+            unsigned char *byte = byteAt(address + i, line);
+            if (byte == NULL) return false;
+            word = (word << 8) | *byte;
+        }
+        value = (int) word;
+        return true;
+    }
+
+    bool store(unsigned int address, int value, int line) {
+        if (address % 4 != 0) return fail(line, "unaligned address " + toString(address));
+        for (int i = 0; i < 4; i++) {
+            unsigned char *byte = byteAt(address + i, line);
+            if (byte == NULL) return false;
+            *byte = ((unsigned int) value >> (8 * i)) & 0xff;
+        }
+        return true;
+    }
+
+    void enter(int function) {
+        if (function == -1) return;
+        if (active[function]++ == 0) activeSince[function] = executed;
+    }
+
+    void leave(int function) {
+        if (function == -1) return;
+        if (--active[function] == 0) inclusive[function] += executed - activeSince[function];
+    }
+
+    bool printString(unsigned int address, ostream &out, int line) {
+        for (;; address++) {
+            unsigned char *byte = byteAt(address, line);
+            if (byte == NULL) return false;
+            if (*byte == 0) return true;
+            out << *byte;
+        }
+    }
+
+    /**
+     * runs the instructions from main on. returns false if the program did something the simulator can not do.
+     */
+    bool execute(ostream &out) {
+        int pc = codeLabels["main"];
+        registers[29] = (int) STACK_TOP;
+        registers[31] = (int) RETURN_TO_EXIT;
+        frames.push_back(Frame(owners[pc], RETURN_TO_EXIT));
+        enter(owners[pc]);
+        while (true) {
+            if (pc < 0 || pc >= code.size()) return fail(0, "the program ran out of its code");
+            const Instruction &instruction = code[pc];
+            runs[pc]++;
+            executed++;
+            int a = registers[instruction.source];
+            int b = instruction.second == -1 ? instruction.immediate : registers[instruction.second];
+            unsigned int ua = a, ub = b;
+            int result = 0;
+            bool isWriting = true;
+            int next = pc + 1;
+            switch (instruction.operation) {
+                case LI:
+                case LA:
+                    result = instruction.immediate;
+                    break;
+                case MOVE:
+                    result = a;
+                    break;
+                case ADDU:
+                    result = (int) (ua + ub);
+                    break;
+                case SUBU:
+                    result = (int) (ua - ub);
+                    break;
+                case MUL:
+                    result = (int) (ua * ub);
+                    break;
+                case DIV:
+                    if (b == 0) return fail(instruction.line, "division by zero");
+                    result = b == -1 ? (int) (0u - ua) : a / b;
+                    break;
+                case MULT: {
+                    long long product = (long long) a * b;
+                    hi = (int) (product >> 32);
+                    lo = (int) product;
+                    isWriting = false;
+                    break;
+                }
+                case MFHI:
+                    result = hi;
+                    break;
+                case MFLO:
+                    result = lo;
+                    break;
+                case AND:
+                    result = (int) (ua & ub);
+                    break;
+                case OR:
+                    result = (int) (ua | ub);
+                    break;
+                case XOR:
+                    result = (int) (ua ^ ub);
+                    break;
+                case NOR:
+                    result = (int) ~(ua | ub);
+                    break;
+                case SLT:
+                    result = a < b;
+                    break;
+                case SLTU:
+                    result = ua < ub;
+                    break;
+                case SLL:
+                    result = (int) (ua << (ub & 31));
+                    break;
+                case SRL:
+                    result = (int) (ua >> (ub & 31));
+                    break;
+                case SRA:
+                    result = a >> (ub & 31);
+                    break;
+                case LW:
+                    if (!load(ua + instruction.immediate, result, instruction.line)) return false;
+                    break;
+                case SW:
+                    if (!store(ua + instruction.immediate, registers[instruction.destination], instruction.line)) {
+                        return false;
+                    }
+                    isWriting = false;
+                    break;
+                case BEQ:
+                case BNE:
+                case BLT:
+                case BLE:
+                case BGT:
+                case BGE: {
+                    bool isTaken = instruction.operation == BEQ ? a == b : instruction.operation == BNE ? a != b
+                                 : instruction.operation == BLT ? a < b : instruction.operation == BLE ? a <= b
+                                 : instruction.operation == BGT ? a > b : a >= b;
+                    branches++;
+                    if (isTaken) {
+                        takenBranches++;
+                        next = instruction.target;
+                    }
+                    isWriting = false;
+                    break;
+                }
+                case J:
+                    next = instruction.target;
+                    //a jump to another function is a tail call, it returns for the caller
+                    if (owners[next] != owners[pc] && !frames.empty() && frames.back().function == owners[pc]) {
+                        leave(frames.back().function);
+                        frames.back().function = owners[next];
+                        enter(owners[next]);
+                    }
+                    isWriting = false;
+                    break;
+                case JAL:
+                    registers[31] = (int) (TEXT_BASE + 4 * (pc + 1));
+                    next = instruction.target;
+                    frames.push_back(Frame(owners[next], TEXT_BASE + 4 * (pc + 1)));
+                    enter(owners[next]);
+                    isWriting = false;
+                    break;
+                case JR:
+                    if (ua == RETURN_TO_EXIT) return true;
+                    if (ua < TEXT_BASE || (ua - TEXT_BASE) % 4 != 0) return fail(instruction.line, "bad jump");
+                    next = (ua - TEXT_BASE) / 4;
+                    if (!frames.empty() && frames.back().returnAddress == ua) {
+                        leave(frames.back().function);
+                        frames.pop_back();
+                    }
+                    isWriting = false;
+                    break;
+                case SYSCALL:
+                    if (registers[2] == 1) {
+                        out << registers[4];
+                    } else if (registers[2] == 4) {
+                        if (!printString(registers[4], out, instruction.line)) return false;
+                    } else if (registers[2] == 10) {
+                        return true;
+                    } else {
+                        return fail(instruction.line, "unsupported syscall " + toString(registers[2]));
+                    }
+                    isWriting = false;
+                    break;
+                case NOP:
+                    isWriting = false;
+                    break;
+            }
+            if (isWriting && instruction.destination != 0) {
+                registers[instruction.destination] = result;
+                if (instruction.destination == 29 && (unsigned int) result < lowestStack) {
+                    lowestStack = result;
+                }
+            }
+            pc = next;
+        }
+    }
+
+public:
+    /**
+     * [functions] are the labels the functions start at, every instruction belongs to the last one before it.
+     */
+    explicit Simulator(const vector<string> &_functions)
+            : code(), codeLabels(), dataLabels(), data(), stack(), functions(_functions), owners(), hi(0), lo(0),
+              error(), runs(), executed(0), takenBranches(0), branches(0), lowestStack(STACK_TOP),
+              inclusive(_functions.size(), 0), active(_functions.size(), 0), activeSince(_functions.size(), 0),
+              frames() {
+        for (int i = 0; i < 32; i++) registers[i] = 0;
+    }
+
+    /**
+     * assembles the program and runs it, printing its output to [out]. returns false, with the error in
+     * getError(), if the program could not be assembled or did something the simulator does not support.
+     */
+    bool run(const string &program, ostream &out) {
+        if (!assemble(program)) return false;
+        runs = vector<long long>(code.size(), 0);
+        bool isRun = execute(out);
+        out.flush();
+        while (!frames.empty()) {
+            leave(frames.back().function);
+            frames.pop_back();
+        }
+        return isRun;
+    }
+
+    string getError() const {
+        return error;
+    }
+
+    void printReport(ostream &out) {
+        map<string, long long> opcodes;
+        map<string, long long> extraCycles;
+        vector<long long> exclusive(functions.size(), 0);
+        long long loads = 0, stores = 0, cycles = executed;
+        for (int i = 0; i < code.size(); i++) {
+            if (runs[i] == 0) continue;
+            opcodes[code[i].opcode] += runs[i];
+            if (owners[i] != -1) exclusive[owners[i]] += runs[i];
+            if (code[i].operation == LW) loads += runs[i];
+            if (code[i].operation == SW) stores += runs[i];
+            if (code[i].operation == MUL || code[i].operation == MULT) cycles += MUL_EXTRA_CYCLES * runs[i];
+            if (code[i].operation == DIV) cycles += DIV_EXTRA_CYCLES * runs[i];
+            if (code[i].operation == J || code[i].operation == JAL || code[i].operation == JR) {
+                cycles += TAKEN_EXTRA_CYCLES * runs[i];
+            }
+        }
+        cycles += TAKEN_EXTRA_CYCLES * takenBranches;
+        out << "code size: " << code.size() << " instructions" << endl;
+        out << "instructions: " << executed << endl;
+        out << "cycles: " << cycles << endl;
+        out << "loads: " << loads << endl;
+        out << "stores: " << stores << endl;
+        out << "taken branches: " << takenBranches << " of " << branches << endl;
+        out << "max stack depth: " << STACK_TOP - lowestStack << " bytes" << endl;
+        out << "opcodes:" << endl;
+        for (map<string, long long>::iterator it = opcodes.begin(); it != opcodes.end(); ++it) {
+            out << "  " << it->first << " " << it->second << endl;
+        }
+        out << "functions (inclusive, exclusive):" << endl;
+        for (int i = 0; i < functions.size(); i++) {
+            if (inclusive[i] == 0 && exclusive[i] == 0) continue;
+            out << "  " << functions[i] << " " << inclusive[i] << " " << exclusive[i] << endl;
+        }
+    }
+};
+
+#endif //HW3_SIMULATOR_HPP
@@ -0,0 +1,391 @@
+#ifndef HW3_VALUE_NUMBERING_HPP
+#define HW3_VALUE_NUMBERING_HPP
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include "control_flow.hpp"
+
+using namespace std;
+
+/**
+ * removes the instructions that compute a value a register already holds, over the code of a whole function.
+ * the code is split into basic blocks, and every write to a register gives it a new value number, like a new
+ * name in SSA form. an instruction is numbered by its opcode and the numbers of its operands, so two
+ * instructions with the same number compute the same value.
+ * a block starts with the registers of its immediate dominator, except the ones that a path between them
+ * writes. where paths join, a register holds the value it has at the end of every predecessor, or a phi value
+ * numbered by the values it joins, like a phi node of SSA form. a loop is first numbered as if its back edges
+ * kept the values that it is entered with, and again without the ones they change.
+ * a computation that is already held in its destination is removed, and one that is held in another register
+ * is removed when its uses in the block can read that register instead.
+ */
+class ValueNumbering {
+private:
+    typedef ControlFlowGraph::Instruction Instruction;
+    typedef ControlFlowGraph::Block Block;
+
+    //the value numbers of the registers and of the stack slots at a point of the code
+    struct State {
+        map<string, int> registers;
+        map<string, int> slots;
+    };
+
+    ControlFlowGraph *graph; //the function that is optimized
+    vector<State> endStates;
+    vector<bool> isNumbered; //the blocks whose end states are known
+    map<string, int> numbers; //the value number of every computation
+    int nextNumber;
+    map<string, int> takenTemps; //the unused temporaries that were given a value, and the block they keep it in
+    int removedCount;
+
+    ValueNumbering()
+            : graph(NULL), endStates(), isNumbered(), numbers(), nextNumber(0), takenTemps(), removedCount(0) {}
+
+    int number(const string &key) {
+        map<string, int>::iterator found = numbers.find(key);
+        if (found != numbers.end()) return found->second;
+        numbers[key] = nextNumber;
+        return nextNumber++;
+    }
+
+    //the value number of the register, an unknown value gets a new one
+    int valueOf(State &state, const string &reg) {
+        if (reg == "$0") return number("li #0");
+        map<string, int>::iterator found = state.registers.find(reg);
+        if (found != state.registers.end()) return found->second;
+        state.registers[reg] = nextNumber;
+        return nextNumber++;
+    }
+
+    int numberComputation(State &state, const Instruction &instruction) {
+        if (instruction.opcode == "move") return valueOf(state, instruction.operands[1]);
+        vector<string> sources;
+        if (instruction.opcode == "mfhi") {
+            sources.push_back("v" + AssemblerCoder::to_string(valueOf(state, "$hi")));
+        }
+        //mult has no destination, its sources start at the first operand
+        for (int i = instruction.opcode == "mult" ? 0 : 1; i < instruction.operands.size(); i++) {
+            const string &operand = instruction.operands[i];
+            sources.push_back(ControlFlowGraph::isRegister(operand)
+                              ? "v" + AssemblerCoder::to_string(valueOf(state, operand)) : "#" + operand);
+        }
+        if (ControlFlowGraph::isCommutative(instruction.opcode) && sources.size() == 2 && sources[0][0] == 'v'
+            && sources[1][0] == 'v' && sources[1] < sources[0]) {
+            swap(sources[0], sources[1]);
+        }
+        string key = instruction.opcode;
+        for (int i = 0; i < sources.size(); i++) key += " " + sources[i];
+        return number(key);
+    }
+
+    //returns a register other than [reg] that holds the value, or ""
+    static string findHolder(const State &state, int value, const string &reg) {
+        for (map<string, int>::const_iterator it = state.registers.begin(); it != state.registers.end(); ++it) {
+            if (it->second != value || it->first == reg || it->first == "$hi") continue;
+            if (it->first == "$sp" || it->first == "$fp" || it->first == "$ra") continue;
+            return it->first;
+        }
+        return "";
+    }
+
+    /**
+     * makes the instructions after [index] in the block read [holder] instead of [reg], until [reg] is written
+     * again. returns false, without changing them, if [holder] is written before the last read or [reg] is
+     * read after the block. only checks it if not [isApplied].
+     */
+    bool forward(int block, int index, const string &reg, const string &holder, bool isApplied = true) {
+        vector<pair<int, int> > uses;
+        bool isHolderWritten = false;
+        bool isRewritten = false;
+        for (int i = index + 1; i < graph->blocks[block].end && !isRewritten; i++) {
+            Instruction &instruction = graph->instructions[i];
+            if (instruction.isRemoved) continue;
+            //a call reads only its arguments, but it may change the other registers
+            if (ControlFlowGraph::isKeptAsIs(instruction)) return false;
+            vector<string> regs = graph->reads(instruction);
+            if (find(regs.begin(), regs.end(), reg) != regs.end()) {
+                //a syscall, mfhi and a jump out of the function read registers that are not their operands
+                if (isHolderWritten || instruction.opcode == "syscall" || instruction.opcode == "mfhi"
+                    || graph->isLeaving(instruction)) {
+                    return false;
+                }
+                for (int j = 0; j < instruction.operands.size(); j++) {
+                    bool isDestination = j == 0 && ControlFlowGraph::written(instruction) != ""
+                                         && instruction.opcode != "mult";
+                    if (instruction.operands[j] == reg && !isDestination) uses.push_back(make_pair(i, j));
+                    if (ControlFlowGraph::baseRegister(instruction.operands[j]) == reg) return false;
+                }
+            }
+            string writtenReg = ControlFlowGraph::written(instruction);
+            if (writtenReg == reg) isRewritten = true;
+            if (writtenReg == holder || (instruction.opcode == "syscall" && holder == "$v0")) isHolderWritten = true;
+        }
+        if (!isRewritten && graph->blocks[block].liveOut.count(reg)) return false;
+        for (int i = 0; i < uses.size() && isApplied; i++) {
+            graph->instructions[uses[i].first].operands[uses[i].second] = holder;
+        }
+        return true;
+    }
+
+    /**
+     * the instruction at [first] computed the value of the one at [index], but its register was written since.
+     * it writes an unused temporary instead, that keeps the value for the later one. returns the temporary, or ""
+     * if the uses of the later instruction can not read it.
+     */
+    string keepComputed(int block, int first, int index) {
+        string temp;
+        for (int i = TEMP_REG_START; i < TEMP_REG_END && temp == ""; i++) {
+            string reg = "$t" + AssemblerCoder::to_string(i);
+            //the temporaries are used only inside the block, another block may take them again
+            map<string, int>::iterator taken = takenTemps.find(reg);
+            if (graph->allRegisters.count(reg) == 0 && (taken == takenTemps.end() || taken->second != block)) {
+                temp = reg;
+            }
+        }
+        Instruction &computation = graph->instructions[first];
+        string reg = graph->instructions[index].operands[0];
+        if (temp == "" || !forward(block, index, reg, temp, false)) return "";
+        if (!forward(block, first, computation.operands[0], temp)) return "";
+        computation.operands[0] = temp;
+        takenTemps[temp] = block;
+        return temp;
+    }
+
+    void remove(Instruction &instruction) {
+        instruction.isRemoved = true;
+        removedCount++;
+    }
+
+    void numberBlock(int block, State &state) {
+        map<int, int> computedAt; //the instruction of the block that computed each value last
+        for (int i = graph->blocks[block].first; i < graph->blocks[block].end; i++) {
+            Instruction &instruction = graph->instructions[i];
+            const string &opcode = instruction.opcode;
+            if (ControlFlowGraph::isKeptAsIs(instruction)) {
+                state.registers.clear();
+                state.slots.clear();
+                computedAt.clear();
+            } else if (opcode == "syscall") {
+                //printing leaves the registers as they are
+                int service = valueOf(state, "$v0");
+                if (service != number("li #1") && service != number("li #4")) state.registers.erase("$v0");
+            } else if (opcode == "sw") {
+                string base = ControlFlowGraph::baseRegister(instruction.operands[1]);
+                int value = valueOf(state, instruction.operands[0]);
+                map<string, int>::iterator slot = state.slots.find(instruction.operands[1]);
+                if (slot != state.slots.end() && slot->second == value) {
+                    remove(instruction);
+                    continue;
+                }
+                //the frame is addressed only by $fp and $sp, a slot of one of them may be a slot of the other
+                for (map<string, int>::iterator it = state.slots.begin(); it != state.slots.end();) {
+                    if (ControlFlowGraph::baseRegister(it->first) != base) {
+                        state.slots.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+                if (base == "$fp" || base == "$sp") {
+                    state.slots[instruction.operands[1]] = value;
+                } else {
+                    state.slots.clear();
+                }
+            } else if (opcode == "mult" || opcode == "lw" || ControlFlowGraph::isComputation(opcode)) {
+                string reg = ControlFlowGraph::written(instruction);
+                int value;
+                if (opcode == "lw") {
+                    string base = ControlFlowGraph::baseRegister(instruction.operands[1]);
+                    map<string, int>::iterator slot = state.slots.find(instruction.operands[1]);
+                    if (slot != state.slots.end()) {
+                        value = slot->second;
+                    } else {
+                        value = nextNumber++;
+                        if (base == "$fp" || base == "$sp") state.slots[instruction.operands[1]] = value;
+                    }
+                } else {
+                    value = numberComputation(state, instruction);
+                }
+                if (valueOf(state, reg) == value) {
+                    remove(instruction);
+                    continue;
+                }
+                string holder = reg == "$hi" ? "" : findHolder(state, value, reg);
+                if (holder == "" && reg != "$hi" && computedAt.count(value)) {
+                    holder = keepComputed(block, computedAt[value], i);
+                    if (holder != "") state.registers[holder] = value;
+                }
+                if (holder != "" && forward(block, i, reg, holder)) {
+                    //the register keeps its old value, its uses read the holder
+                    remove(instruction);
+                    continue;
+                }
+                if (holder != "" && (opcode == "mul" || opcode == "div")) {
+                    instruction.opcode = "move";
+                    instruction.operands.resize(2);
+                    instruction.operands[1] = holder;
+                }
+                state.registers[reg] = value;
+                if (reg != "$hi") computedAt[value] = i;
+            }
+        }
+    }
+
+    bool isDominatedBy(int block, int dominator) const {
+        for (int next = block; next != -1; next = graph->blocks[next].dominator) {
+            if (next == dominator) return true;
+        }
+        return false;
+    }
+
+    /**
+     * the values of the registers at the end of all the predecessors of the block: the one they all hold, or
+     * else a phi value of the block and of the values they hold. [backEdges] gets the predecessors the block
+     * dominates, that are not numbered yet - only the registers with one value are joined when there are any.
+     */
+    map<string, int> joinPredecessors(int block, vector<int> &backEdges) {
+        const vector<int> &predecessors = graph->blocks[block].predecessors;
+        vector<int> entering;
+        for (int i = 0; i < predecessors.size(); i++) {
+            if (isNumbered[predecessors[i]]) {
+                entering.push_back(predecessors[i]);
+            } else if (isDominatedBy(predecessors[i], block)) {
+                backEdges.push_back(predecessors[i]);
+            } else {
+                return map<string, int>();
+            }
+        }
+        map<string, int> joined;
+        if (entering.size() + backEdges.size() < 2 || entering.empty()) return joined;
+        const map<string, int> &first = endStates[entering[0]].registers;
+        for (map<string, int>::const_iterator it = first.begin(); it != first.end(); ++it) {
+            string key = "phi " + AssemblerCoder::to_string(block);
+            bool isSame = true;
+            bool isHeld = true;
+            for (int i = 0; i < entering.size() && isHeld; i++) {
+                const map<string, int> &registers = endStates[entering[i]].registers;
+                map<string, int>::const_iterator value = registers.find(it->first);
+                isHeld = value != registers.end();
+                if (!isHeld) break;
+                isSame = isSame && value->second == it->second;
+                key += " v" + AssemblerCoder::to_string(value->second);
+            }
+            if (!isHeld || (!isSame && !backEdges.empty())) continue;
+            joined[it->first] = isSame ? it->second : number(key);
+        }
+        return joined;
+    }
+
+    /**
+     * numbers the block and the ones it dominates. the registers of [assumed] are kept by the loop the block
+     * heads, the loop is numbered again without the ones whose values its back edges change.
+     */
+    void numberLoop(int block, const State &state, map<string, int> assumed, const vector<int> &backEdges) {
+        vector<Instruction> instructions = graph->instructions;
+        vector<State> states = endStates;
+        vector<bool> numbered = isNumbered;
+        map<string, int> temps = takenTemps;
+        int removed = removedCount;
+        while (true) {
+            State start = state;
+            start.registers.insert(assumed.begin(), assumed.end());
+            numberDominated(block, start);
+            vector<string> changed;
+            for (map<string, int>::iterator it = assumed.begin(); it != assumed.end(); ++it) {
+                bool isKept = takenTemps.count(it->first) == 0;
+                for (int i = 0; i < backEdges.size() && isKept; i++) {
+                    const map<string, int> &registers = endStates[backEdges[i]].registers;
+                    map<string, int>::const_iterator value = registers.find(it->first);
+                    isKept = value != registers.end() && value->second == it->second;
+                }
+                if (!isKept) changed.push_back(it->first);
+            }
+            if (changed.empty()) return;
+            for (int i = 0; i < changed.size(); i++) assumed.erase(changed[i]);
+            graph->instructions = instructions;
+            endStates = states;
+            isNumbered = numbered;
+            takenTemps = temps;
+            removedCount = removed;
+        }
+    }
+
+    void numberDominated(int block) {
+        State state;
+        map<string, int> assumed;
+        vector<int> backEdges;
+        if (graph->blocks[block].dominator != -1) {
+            state = endStates[graph->blocks[block].dominator];
+            vector<int> between = graph->pathsBetween(graph->blocks[block].dominator, block);
+            for (int i = 0; i < between.size(); i++) {
+                const Block &other = graph->blocks[between[i]];
+                if (other.isClobbering) {
+                    state.registers.clear();
+                    state.slots.clear();
+                }
+                for (set<string>::const_iterator it = other.writes.begin(); it != other.writes.end(); ++it) {
+                    state.registers.erase(*it);
+                }
+                if (other.isStoring) state.slots.clear();
+            }
+            map<string, int> joined = graph->isRoot(block) ? map<string, int>() : joinPredecessors(block, backEdges);
+            for (map<string, int>::iterator it = joined.begin(); it != joined.end(); ++it) {
+                if (state.registers.count(it->first)) continue;
+                if (backEdges.empty()) {
+                    state.registers[it->first] = it->second;
+                } else {
+                    assumed[it->first] = it->second;
+                }
+            }
+            for (map<string, int>::iterator it = takenTemps.begin(); it != takenTemps.end(); ++it) {
+                state.registers.erase(it->first);
+                assumed.erase(it->first);
+            }
+        }
+        if (assumed.empty()) {
+            numberDominated(block, state);
+        } else {
+            numberLoop(block, state, assumed, backEdges);
+        }
+    }
+
+    void numberDominated(int block, State state) {
+        numberBlock(block, state);
+        endStates[block] = state;
+        isNumbered[block] = true;
+        const vector<int> &dominated = graph->blocks[block].dominated;
+        for (int i = 0; i < dominated.size(); i++) numberDominated(dominated[i]);
+    }
+
+public:
+    static ValueNumbering &getInstance() {
+        static ValueNumbering INSTANCE;
+        return INSTANCE;
+    }
+
+    /**
+     * numbers the values of the function's code in [functionStart, functionEnd) and removes the redundant
+     * computations. [returned] are the registers the caller reads after it returns. the code must not be
+     * changed by addresses that were kept before, other than its jumps.
+     */
+    void optimizeFunction(int functionStart, int functionEnd, const set<string> &returned) {
+        ControlFlowGraph code(functionStart, functionEnd, returned);
+        if (!code.isLinked) return;
+        graph = &code;
+        takenTemps.clear();
+        endStates = vector<State>(code.blocks.size());
+        isNumbered = vector<bool>(code.blocks.size(), false);
+        for (int i = 0; i < code.blocks.size(); i++) {
+            if (code.blocks[i].dominator == -1 && code.isRoot(i)) numberDominated(i);
+        }
+        code.rewrite();
+        graph = NULL;
+    }
+
+    void printReport(ostream &out) {
+        out << "removed " << removedCount << " redundant computations" << endl;
+    }
+};
+
+#endif //HW3_VALUE_NUMBERING_HPP
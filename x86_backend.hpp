@@ -0,0 +1,498 @@
+#ifndef HW3_X86_BACKEND_HPP
+#define HW3_X86_BACKEND_HPP
+#define X86_STACK_BYTES (64 * 1024 * 1024) //the stack the MIPS code runs on, $sp starts at its top
+#define X86_OUTPUT_BYTES (4096) //the printing is buffered, the buffer is written when it is full and at the exit
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * translates the MIPS program the compiler emits into x86-64 assembly for Linux, that the system's assembler
+ * and linker build into a native executable without any library:
+ *     as program.s -o program.o && ld program.o -o program
+ * every MIPS instruction is translated on its own, so all the optimizations of the MIPS code are kept.
+ * the MIPS registers the code uses most live in x86 registers, the others in memory, and all the values and
+ * addresses are 32 bits, like in MIPS - the program is linked at fixed addresses under 2GB, and its stack is
+ * a block of its data. jal keeps the address to return to in $ra, and jr jumps to it, like MIPS does.
+ * the syscalls print_int, print_string and exit go to a small runtime that makes Linux system calls.
+ * it is a translation of the output, not a second code generator: the functions keep the MIPS calling
+ * convention, not the System V one, and AssemblerCoder and Registers emit and allocate for MIPS only.
+ */
+class X86Backend {
+private:
+    vector<string> text;
+    vector<string> data;
+    map<string, string> homes; //the x86 register or the memory every MIPS register lives in
+    int returnCount;
+    string error;
+
+    static bool isRegister(const string &operand) {
+        return operand.size() > 1 && operand[0] == '$';
+    }
+
+    static bool isZero(const string &reg) {
+        return reg == "$0" || reg == "$zero";
+    }
+
+    static string trim(const string &text) {
+        size_t first = text.find_first_not_of(" \t");
+        if (first == string::npos) return "";
+        return text.substr(first, text.find_last_not_of(" \t") + 1 - first);
+    }
+
+    static vector<string> splitOperands(const string &text) {
+        vector<string> operands;
+        stringstream ss(text);
+        string operand;
+        while (getline(ss, operand, ',')) {
+            if (trim(operand) != "") operands.push_back(trim(operand));
+        }
+        return operands;
+    }
+
+    static bool isMemory(const string &operand) {
+        return operand[0] != '%' && operand[0] != '$';
+    }
+
+    bool fail(const string &line, const string &message) {
+        if (error == "") error = message + ": " + line;
+        return false;
+    }
+
+    void emit(const string &command) {
+        text.push_back("\t" + command);
+    }
+
+    /**
+     * gives the MIPS registers the code uses most the x86 registers that the translation does not need for
+     * itself - %eax, %ecx and %edx are its scratch registers. the others get a word of memory.
+     */
+    void allocateHomes(const vector<string> &code) {
+        static const char *x86Registers[] = {"%ebx", "%ebp", "%esi", "%edi", "%r8d", "%r9d", "%r10d", "%r11d",
+                                             "%r12d", "%r13d", "%r14d", "%r15d"};
+        map<string, int> uses;
+        uses["$sp"] = 0;
+        uses["$ra"] = 0;
+        uses["$v0"] = 0;
+        uses["$a0"] = 0;
+        uses["$hi"] = 0;
+        uses["$lo"] = 0;
+        for (int i = 0; i < code.size(); i++) {
+            for (size_t found = code[i].find('$'); found != string::npos; found = code[i].find('$', found + 1)) {
+                size_t end = code[i].find_first_of(" ,()", found);
+                string reg = code[i].substr(found, end == string::npos ? string::npos : end - found);
+                if (!isZero(reg)) uses[reg]++;
+            }
+        }
+        vector<pair<int, string> > byUses;
+        for (map<string, int>::iterator it = uses.begin(); it != uses.end(); ++it) {
+            byUses.push_back(make_pair(-it->second, it->first));
+        }
+        sort(byUses.begin(), byUses.end());
+        int memoryCount = 0;
+        for (int i = 0; i < byUses.size(); i++) {
+            const string &reg = byUses[i].second;
+            if (i < sizeof(x86Registers) / sizeof(x86Registers[0])) {
+                homes[reg] = x86Registers[i];
+            } else {
+                stringstream home;
+                home << "_fanc_registers+" << 4 * memoryCount++;
+                homes[reg] = home.str();
+            }
+        }
+        stringstream registers;
+        registers << "_fanc_registers: .space " << 4 * max(memoryCount, 1);
+        data.push_back("\t.balign 4");
+        data.push_back(registers.str());
+    }
+
+    //the x86 operand of a MIPS register or immediate
+    string operandOf(const string &operand) {
+        if (isZero(operand)) return "$0";
+        if (isRegister(operand)) return homes[operand];
+        return "$" + operand;
+    }
+
+    //an operand the x86 instructions can write to, or read as their destination: a register or memory
+    string valueIn(const string &operand, const string &scratch) {
+        string x86 = operandOf(operand);
+        if (x86[0] != '%') {
+            emit("movl " + x86 + ", " + scratch);
+            return scratch;
+        }
+        return x86;
+    }
+
+    void move(const string &source, const string &destination) {
+        if (source == destination) return;
+        if (isMemory(source) && isMemory(destination)) {
+            emit("movl " + source + ", %eax");
+            emit("movl %eax, " + destination);
+            return;
+        }
+        emit("movl " + source + ", " + destination);
+    }
+
+    //the address "offset(base)" in x86, its base is in a register
+    string addressOf(const string &operand) {
+        size_t open = operand.find('(');
+        string offset = open == 0 ? "0" : operand.substr(0, open);
+        string base = valueIn(operand.substr(open + 1, operand.size() - open - 2), "%ecx");
+        return offset + "(" + base + ")";
+    }
+
+    /**
+     * [destination] = [source] [opcode] [second], the x86 [opcode] works on its destination.
+     */
+    void binary(const string &opcode, const string &destination, const string &source, const string &second) {
+        string target = operandOf(destination);
+        string secondOperand = operandOf(second);
+        if (target[0] == '%' && target != secondOperand) {
+            move(operandOf(source), target);
+            emit(opcode + " " + secondOperand + ", " + target);
+            return;
+        }
+        move(operandOf(source), "%eax");
+        emit(opcode + " " + secondOperand + ", %eax");
+        move("%eax", target);
+    }
+
+    void shift(const string &opcode, const string &destination, const string &source, const string &amount) {
+        string count = operandOf(amount);
+        if (count[0] != '$') {
+            emit("movl " + count + ", %ecx");
+            count = "%cl";
+        }
+        move(operandOf(source), "%eax");
+        emit(opcode + " " + count + ", %eax");
+        move("%eax", operandOf(destination));
+    }
+
+    //compares [first] to [second], the condition of a branch or a set
+    void compare(const string &first, const string &second) {
+        string left = operandOf(first);
+        string right = operandOf(second);
+        //an immediate can only be the second, and only one of them can be in memory
+        if (left[0] == '$' || (isMemory(left) && isMemory(right))) {
+            emit("movl " + left + ", %eax");
+            left = "%eax";
+        }
+        emit("cmpl " + right + ", " + left);
+    }
+
+    //the signed division of %eax by %ecx into %eax and %edx. x86 traps on the overflow of -2^31 / -1
+    void divide() {
+        emit("cmpl $-1, %ecx");
+        emit("jne 1f");
+        emit("negl %eax");
+        emit("xorl %edx, %edx");
+        emit("jmp 2f");
+        text.push_back("1:");
+        emit("cltd");
+        emit("idivl %ecx");
+        text.push_back("2:");
+    }
+
+    string returnLabel() {
+        stringstream label;
+        label << "_fanc_return_" << returnCount++;
+        return label.str();
+    }
+
+    bool translateInstruction(const string &line) {
+        size_t space = line.find_first_of(" \t");
+        string opcode = line.substr(0, space);
+        vector<string> operands = splitOperands(space == string::npos ? "" : line.substr(space + 1));
+        static const char *branches[][2] = {{"beq", "je"}, {"bne", "jne"}, {"blt", "jl"}, {"ble", "jle"},
+                                            {"bgt", "jg"}, {"bge", "jge"}};
+        for (int i = 0; i < 6; i++) {
+            if (opcode != branches[i][0]) continue;
+            if (operands.size() != 3) return fail(line, "bad operands");
+            compare(operands[0], operands[1]);
+            emit(string(branches[i][1]) + " " + operands[2]);
+            return true;
+        }
+        if (opcode == "addiu" || opcode == "addi" || opcode == "add") opcode = "addu";
+        if (opcode == "sub") opcode = "subu";
+        if (opcode == "andi") opcode = "and";
+        if (opcode == "ori") opcode = "or";
+        if (opcode == "xori") opcode = "xor";
+        if (opcode == "slti") opcode = "slt";
+        if (opcode == "sltiu") opcode = "sltu";
+        static const char *arithmetic[][2] = {{"addu", "addl"}, {"subu", "subl"}, {"mul", "imull"},
+                                              {"and", "andl"}, {"or", "orl"}, {"xor", "xorl"}};
+        for (int i = 0; i < 6; i++) {
+            if (opcode != arithmetic[i][0]) continue;
+            if (operands.size() != 3) return fail(line, "bad operands");
+            binary(arithmetic[i][1], operands[0], operands[1], operands[2]);
+            return true;
+        }
+        static const char *shifts[][2] = {{"sll", "shll"}, {"srl", "shrl"}, {"sra", "sarl"}};
+        for (int i = 0; i < 3; i++) {
+            if (opcode != shifts[i][0]) continue;
+            if (operands.size() != 3) return fail(line, "bad operands");
+            shift(shifts[i][1], operands[0], operands[1], operands[2]);
+            return true;
+        }
+        if (opcode == "syscall") {
+            move(operandOf("$v0"), "%eax");
+            move(operandOf("$a0"), "%edx");
+            emit("call _fanc_syscall");
+        } else if (opcode == "nop") {
+        } else if (opcode == "j" && operands.size() == 1) {
+            emit("jmp " + operands[0]);
+        } else if (opcode == "jal" && operands.size() == 1) {
+            string label = returnLabel();
+            emit("movl $" + label + ", " + operandOf("$ra"));
+            emit("jmp " + operands[0]);
+            text.push_back(label + ":");
+        } else if (opcode == "jr" && operands.size() == 1) {
+            move(operandOf(operands[0]), "%eax");
+            emit("jmp *%rax");
+        } else if ((opcode == "li" || opcode == "la") && operands.size() == 2) {
+            move("$" + operands[1], operandOf(operands[0]));
+        } else if (opcode == "move" && operands.size() == 2) {
+            move(operandOf(operands[1]), operandOf(operands[0]));
+        } else if ((opcode == "mfhi" || opcode == "mflo") && operands.size() == 1) {
+            move(operandOf(opcode == "mfhi" ? "$hi" : "$lo"), operandOf(operands[0]));
+        } else if (opcode == "nor" && operands.size() == 3) {
+            binary("orl", operands[0], operands[1], operands[2]);
+            emit("notl " + operandOf(operands[0]));
+        } else if ((opcode == "slt" || opcode == "sltu") && operands.size() == 3) {
+            compare(operands[1], operands[2]);
+            emit(opcode == "slt" ? "setl %al" : "setb %al");
+            emit("movzbl %al, %eax");
+            move("%eax", operandOf(operands[0]));
+        } else if (opcode == "div" && (operands.size() == 3 || operands.size() == 2)) {
+            //the three operands form keeps the quotient, the other keeps both in $lo and $hi
+            bool isPseudo = operands.size() == 3;
+            move(operandOf(operands[isPseudo ? 1 : 0]), "%eax");
+            move(operandOf(operands[isPseudo ? 2 : 1]), "%ecx");
+            divide();
+            if (isPseudo) {
+                move("%eax", operandOf(operands[0]));
+            } else {
+                move("%eax", operandOf("$lo"));
+                move("%edx", operandOf("$hi"));
+            }
+        } else if (opcode == "mult" && operands.size() == 2) {
+            move(operandOf(operands[0]), "%eax");
+            move(operandOf(operands[1]), "%ecx");
+            emit("imull %ecx");
+            move("%eax", operandOf("$lo"));
+            move("%edx", operandOf("$hi"));
+        } else if (opcode == "lw" && operands.size() == 2) {
+            string address = addressOf(operands[1]);
+            string destination = operandOf(operands[0]);
+            if (destination[0] == '%') {
+                emit("movl " + address + ", " + destination);
+            } else {
+                emit("movl " + address + ", %eax");
+                emit("movl %eax, " + destination);
+            }
+        } else if (opcode == "sw" && operands.size() == 2) {
+            string value = operandOf(operands[0]);
+            if (isMemory(value)) value = valueIn(operands[0], "%eax");
+            emit("movl " + value + ", " + addressOf(operands[1]));
+        } else {
+            return fail(line, "unsupported instruction");
+        }
+        return true;
+    }
+
+    bool translateData(const string &line) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) return fail(line, "a data line without a label");
+        string rest = trim(line.substr(colon + 1));
+        string directive = rest.substr(0, rest.find_first_of(" \t"));
+        string value = trim(rest.substr(directive.size()));
+        if (directive == ".word") {
+            data.push_back("\t.balign 4");
+            directive = ".long";
+        } else if (directive == ".asciiz") {
+            directive = ".asciz";
+        } else if (directive != ".ascii" && directive != ".space") {
+            return fail(line, "unsupported directive");
+        }
+        data.push_back(line.substr(0, colon + 1) + " " + directive + " " + value);
+        return true;
+    }
+
+    /**
+     * starts the program at main, with the stack and a return address that exits.
+     * the syscall service is in %eax and its argument in %edx, the runtime keeps all the other registers.
+     */
+    void emitRuntime() {
+        static const char *runtime[] = {
+                "_fanc_syscall:",
+                "\tcmpl $1, %eax",
+                "\tje _fanc_print_int",
+                "\tcmpl $4, %eax",
+                "\tje _fanc_print_string",
+                "\tcmpl $10, %eax",
+                "\tje _fanc_exit",
+                "\tret",
+                "_fanc_print_string:",
+                "\tpushq %rsi",
+                "\tmovl %edx, %esi",
+                "1:",
+                "\tmovzbl (%rsi), %eax",
+                "\ttestl %eax, %eax",
+                "\tje 2f",
+                "\tcall _fanc_put",
+                "\tincq %rsi",
+                "\tjmp 1b",
+                "2:",
+                "\tpopq %rsi",
+                "\tret",
+                "_fanc_print_int:",
+                "\tpushq %rcx",
+                "\tpushq %rsi",
+                "\tpushq %rdi",
+                "\tmovl %edx, %esi",
+                "\ttestl %esi, %esi",
+                "\tjns 1f",
+                "\tmovl $45, %eax",
+                "\tcall _fanc_put",
+                "\tnegl %esi",
+                "1:",
+                "\tmovl %esi, %eax",
+                "\tmovl $10, %edi",
+                "\txorl %ecx, %ecx",
+                "2:",
+                "\txorl %edx, %edx",
+                "\tdivl %edi",
+                "\taddl $48, %edx",
+                "\tpushq %rdx",
+                "\tincl %ecx",
+                "\ttestl %eax, %eax",
+                "\tjne 2b",
+                "3:",
+                "\tpopq %rax",
+                "\tcall _fanc_put",
+                "\tdecl %ecx",
+                "\tjne 3b",
+                "\tpopq %rdi",
+                "\tpopq %rsi",
+                "\tpopq %rcx",
+                "\tret",
+                "#adds the character in %al to the output",
+                "_fanc_put:",
+                "\tpushq %rcx",
+                "\tmovl _fanc_output_size, %ecx",
+                "\tmovb %al, _fanc_output(%rcx)",
+                "\tincl %ecx",
+                "\tmovl %ecx, _fanc_output_size",
+                "\tcmpl $_fanc_output_bytes, %ecx",
+                "\tjne 1f",
+                "\tcall _fanc_flush",
+                "1:",
+                "\tpopq %rcx",
+                "\tret",
+                "_fanc_flush:",
+                "\tpushq %rax",
+                "\tpushq %rcx",
+                "\tpushq %rdx",
+                "\tpushq %rsi",
+                "\tpushq %rdi",
+                "\tpushq %r11",
+                "\tmovl $_fanc_output, %esi",
+                "\tmovl _fanc_output_size, %edx",
+                "1:",
+                "\ttestl %edx, %edx",
+                "\tjle 2f",
+                "\tmovl $1, %eax",
+                "\tmovl $1, %edi",
+                "\tsyscall",
+                "\ttestl %eax, %eax",
+                "\tjle 2f",
+                "\taddq %rax, %rsi",
+                "\tsubl %eax, %edx",
+                "\tjmp 1b",
+                "2:",
+                "\tmovl $0, _fanc_output_size",
+                "\tpopq %r11",
+                "\tpopq %rdi",
+                "\tpopq %rsi",
+                "\tpopq %rdx",
+                "\tpopq %rcx",
+                "\tpopq %rax",
+                "\tret",
+                "_fanc_exit:",
+                "\tcall _fanc_flush",
+                "\tmovl $60, %eax",
+                "\txorl %edi, %edi",
+                "\tsyscall"
+        };
+        text.push_back("_start:");
+        move("$_fanc_stack+_fanc_stack_bytes-4", operandOf("$sp"));
+        move("$_fanc_exit", operandOf("$ra"));
+        emit("jmp main");
+        text.insert(text.end(), runtime, runtime + sizeof(runtime) / sizeof(runtime[0]));
+    }
+
+public:
+    X86Backend() : text(), data(), homes(), returnCount(0), error() {}
+
+    /**
+     * translates the MIPS [program] and prints the x86-64 program to [out]. returns false, with the error in
+     * getError(), if the program has something the translation does not support.
+     */
+    bool translate(const string &program, ostream &out) {
+        stringstream lines(program);
+        string line;
+        bool isData = false;
+        vector<string> code;
+        vector<string> dataLines;
+        while (getline(lines, line)) {
+            line = trim(line);
+            if (line == "" || line[0] == '#') continue;
+            if (line == ".data" || line == ".text") {
+                isData = line == ".data";
+                continue;
+            }
+            if (line[0] == '.') continue;
+            (isData ? dataLines : code).push_back(line);
+        }
+        allocateHomes(code);
+        for (int i = 0; i < dataLines.size(); i++) {
+            if (!translateData(dataLines[i])) return false;
+        }
+        emitRuntime();
+        for (int i = 0; i < code.size(); i++) {
+            line = code[i];
+            size_t colon = line.find(':');
+            if (colon != string::npos && line.find(' ') > colon) {
+                text.push_back(line.substr(0, colon + 1));
+                line = trim(line.substr(colon + 1));
+                if (line == "") continue;
+            }
+            if (!translateInstruction(line)) return false;
+        }
+        out << "#translated from MIPS, build it with: as program.s -o program.o && ld program.o -o program" << endl;
+        out << "\t.equ _fanc_stack_bytes, " << X86_STACK_BYTES << endl;
+        out << "\t.equ _fanc_output_bytes, " << X86_OUTPUT_BYTES << endl;
+        out << "\t.data" << endl;
+        for (int i = 0; i < data.size(); i++) out << data[i] << endl;
+        out << "\t.bss" << endl;
+        out << "\t.balign 16" << endl;
+        out << "_fanc_stack: .space _fanc_stack_bytes" << endl;
+        out << "_fanc_output: .space _fanc_output_bytes" << endl;
+        out << "_fanc_output_size: .space 4" << endl;
+        out << "\t.text" << endl;
+        out << "\t.globl _start" << endl;
+        for (int i = 0; i < text.size(); i++) out << text[i] << endl;
+        return true;
+    }
+
+    string getError() const {
+        return error;
+    }
+};
+
+#endif //HW3_X86_BACKEND_HPP